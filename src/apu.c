@@ -0,0 +1,799 @@
+#include "apu.h"
+#include "bus.h"
+#include "system.h"
+#include "timer.h"
+
+/* Audio processing unit.
+
+   Each channel keeps the time of the next step of its waveform timer, and is
+   only run forward -- step by step, from one edge of its output to the next
+   -- when the APU catches up. Output changes are added to the sample buffer
+   as band-limited steps (a windowed-sinc impulse, integrated when the buffer
+   is read), so no per-cycle work or output filtering is needed. */
+
+#define NUM_CHANNELS 4
+enum { CH_SQUARE1, CH_SQUARE2, CH_WAVE, CH_NOISE };
+
+/* The frame sequencer steps on each falling edge of bit 12 of the timer's
+   internal counter (bit 4 of DIV), at 512 Hz. */
+#define FS_PERIOD 8192
+#define NEVER UINT64_MAX
+
+#define REG(addr) regs[(addr) - NR10_REG]
+#define NUM_REGS (WAVE_RAM_END - NR10_REG + 1)
+
+/* Bits that read back as 1, from NR10 through 0xFF2F. */
+static const byte read_masks[WAVE_RAM_START - NR10_REG] = {
+    0x80, 0x3F, 0x00, 0xFF, 0xBF, /* NR10-NR14 */
+    0xFF, 0x3F, 0x00, 0xFF, 0xBF, /* NR20-NR24 */
+    0x7F, 0xFF, 0x9F, 0xFF, 0xBF, /* NR30-NR34 */
+    0xFF, 0xFF, 0x00, 0x00, 0xBF, /* NR40-NR44 */
+    0x00, 0x00, 0x70,             /* NR50-NR52 */
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF
+};
+
+/* Waveform steps 0-7, from the most significant bit. */
+static const byte duty_patterns[4] = { 0x01, 0x81, 0x87, 0x7E };
+/* Right shifts of wave samples for each NR32 volume code. */
+static const int wave_shifts[4] = { 4, 0, 1, 2 };
+
+typedef struct {
+    bool on;             /* As reported by NR52. */
+    bool dac;
+    int length;
+    bool length_enabled;
+    int freq;
+    int out;             /* Digital output, 0-15. */
+    uint64_t next;       /* T-cycle of the next waveform step. */
+    int pos;             /* Duty or wave RAM position. */
+    int volume;
+    int env_timer;
+    byte sample;         /* Wave channel. */
+    uint16_t lfsr;       /* Noise channel. */
+} apu_channel;
+
+static byte regs[NUM_REGS];
+static bool power;
+static apu_channel chans[NUM_CHANNELS];
+
+static int sweep_timer;
+static int sweep_shadow;
+static bool sweep_enabled;
+/* Whether a subtraction was calculated since the last trigger -- clearing
+   the negate bit afterwards disables the channel. */
+static bool sweep_negated;
+
+static uint64_t apu_clock;
+static uint64_t fs_next;
+static int fs_step;
+
+/* Weight of each channel's output on the left and right outputs. */
+#define AMP_UNIT 64
+static int gains[NUM_CHANNELS][2];
+
+/* Band-limited synthesis */
+
+#define BLIP_SIZE 2048
+#define KERNEL_WIDTH 16
+#define PHASE_BITS 6
+#define NUM_PHASES (1 << PHASE_BITS)
+/* The taps of each phase sum to 1 << KERNEL_UNIT. */
+#define KERNEL_UNIT 15
+/* Leak of the output integrator -- a high-pass filter at about 15 Hz, like
+   the capacitors on the hardware outputs. */
+#define BASS_SHIFT 9
+#define FLUSH_SAMPLES 512
+
+static int16_t kernel[NUM_PHASES][KERNEL_WIDTH];
+static bool kernel_ready = false;
+/* Deltas, for the left and right outputs. */
+static int32_t blip[2][BLIP_SIZE + KERNEL_WIDTH];
+static int64_t integrator[2];
+/* Output samples per T-cycle, in 32.32 fixed point. */
+static uint64_t blip_factor;
+/* Samples from the start of the buffers that may hold deltas -- 0 while
+   the output is constant. */
+static int blip_extent;
+/* The first buffered sample starts blip_frac after blip_time. */
+static uint64_t blip_time;
+static uint64_t blip_frac;
+static uint64_t flush_cycles;
+static uint64_t flush_at;
+static int16_t out_samples[BLIP_SIZE * 2];
+static void (*sink_fn)(const int16_t *samples, int frames);
+/* Each channel's share of the left and right outputs, while a channel sink
+   is set. Not part of snapshots. */
+static int32_t (*stem_blip)[2][BLIP_SIZE + KERNEL_WIDTH];
+static int64_t stem_integrator[NUM_CHANNELS][2];
+static void (*channel_sink_fn)(int channel, const int16_t *samples, int frames);
+
+/* Flushes, and those with no output changes and a settled integrator, whose
+   samples were filled in without integration. Created once, like the
+   kernel. */
+static SDL_Mutex *stats_lock;
+static apu_stats stats;
+
+static void catch_up(void);
+static void write_nr51(byte nr50, byte nr51);
+
+static void init_kernel(void)
+{
+    /* Windowed sinc, cut off a little below the Nyquist frequency. */
+    const double cutoff = 0.9;
+    for (int p = 0; p < NUM_PHASES; p++) {
+        double taps[KERNEL_WIDTH];
+        double sum = 0;
+        for (int k = 0; k < KERNEL_WIDTH; k++) {
+            double x = k - (KERNEL_WIDTH / 2 - 1) - (double)p / NUM_PHASES;
+            double sinc = x == 0 ? 1 : SDL_sin(SDL_PI_D * cutoff * x) /
+                (SDL_PI_D * cutoff * x);
+            double n = (x + KERNEL_WIDTH / 2) / KERNEL_WIDTH;
+            double window = 0.42 - 0.5 * SDL_cos(2 * SDL_PI_D * n) +
+                0.08 * SDL_cos(4 * SDL_PI_D * n);
+            taps[k] = sinc * window;
+            sum += taps[k];
+        }
+        /* Rounding errors go to the largest tap, so a step settles exactly. */
+        int total = 0, largest = 0;
+        for (int k = 0; k < KERNEL_WIDTH; k++) {
+            kernel[p][k] = (int16_t)(taps[k] / sum * (1 << KERNEL_UNIT) + 0.5);
+            total += kernel[p][k];
+            if (kernel[p][k] > kernel[p][largest])
+                largest = k;
+        }
+        kernel[p][largest] += (1 << KERNEL_UNIT) - total;
+    }
+    kernel_ready = true;
+}
+
+static void add_delta(int32_t *buf, uint64_t t, int delta)
+{
+    uint64_t pos = (t - blip_time) * blip_factor + blip_frac;
+    size_t i = pos >> 32;
+    if (i >= BLIP_SIZE)
+        return;
+    const int16_t *taps = kernel[(pos >> (32 - PHASE_BITS)) & (NUM_PHASES - 1)];
+    blip_extent = SDL_max(blip_extent, (int)i + KERNEL_WIDTH);
+    int32_t *dst = &buf[i];
+    for (int k = 0; k < KERNEL_WIDTH; k++)
+        dst[k] += taps[k] * delta;
+}
+
+/* Adds a change of a channel's contribution to one side. */
+static void add_channel_delta(int idx, int side, uint64_t t, int delta)
+{
+    add_delta(blip[side], t, delta);
+    if (stem_blip != NULL)
+        add_delta(stem_blip[idx][side], t, delta);
+}
+
+bool apu_init(int rate)
+{
+    if (!kernel_ready)
+        init_kernel();
+    if (stats_lock == NULL && (stats_lock = SDL_CreateMutex()) == NULL)
+        return false;
+    if (rate <= 0)
+        rate = APU_DEFAULT_RATE;
+    blip_factor = ((uint64_t)rate << 32) / T_CYCLES_PER_SEC;
+    flush_cycles = (uint64_t)FLUSH_SAMPLES * T_CYCLES_PER_SEC / rate;
+    SDL_memset(blip, 0, sizeof(blip));
+    integrator[0] = integrator[1] = 0;
+    blip_extent = 0;
+    SDL_LockMutex(stats_lock);
+    stats = (apu_stats){ 0 };
+    SDL_UnlockMutex(stats_lock);
+    if (stem_blip != NULL)
+        SDL_memset(stem_blip, 0, sizeof(*stem_blip) * NUM_CHANNELS);
+    SDL_memset(stem_integrator, 0, sizeof(stem_integrator));
+    apu_clock = 0;
+    blip_time = 0;
+    blip_frac = 0;
+    flush_at = flush_cycles;
+
+    /* DMG boot handoff state, with the boot sound faded out. */
+    static const byte boot_regs[] = {
+        0x80, 0xBF, 0xF3, 0xFF, 0xBF,
+        0xFF, 0x3F, 0x00, 0xFF, 0xBF,
+        0x7F, 0xFF, 0x9F, 0xFF, 0xBF,
+        0xFF, 0xFF, 0x00, 0x00, 0xBF,
+        0x77, 0xF3, 0xF1
+    };
+    SDL_memset(regs, 0, sizeof(regs));
+    SDL_memcpy(regs, boot_regs, sizeof(boot_regs));
+    SDL_memset(chans, 0, sizeof(chans));
+    power = true;
+    chans[CH_SQUARE1].on = true;
+    chans[CH_SQUARE1].dac = true;
+    chans[CH_SQUARE1].freq = 0x7FF;
+    chans[CH_SQUARE1].next = NEVER;
+    for (int i = 0; i < NUM_CHANNELS; i++)
+        chans[i].length = i == CH_WAVE ? 256 : 64;
+    sweep_timer = 8;
+    sweep_shadow = 0;
+    sweep_enabled = sweep_negated = false;
+    SDL_memset(gains, 0, sizeof(gains));
+    write_nr51(REG(NR50_REG), REG(NR51_REG));
+
+    uint64_t counter = timer_get_counter();
+    uint64_t until_edge = FS_PERIOD - counter % FS_PERIOD;
+    fs_next = (until_edge + T_M_RATIO - 1) / T_M_RATIO * T_M_RATIO;
+    fs_step = 0;
+    return true;
+}
+
+void apu_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, regs);
+    SNAPSHOT(s, power);
+    SNAPSHOT(s, chans);
+    SNAPSHOT(s, sweep_timer);
+    SNAPSHOT(s, sweep_shadow);
+    SNAPSHOT(s, sweep_enabled);
+    SNAPSHOT(s, sweep_negated);
+    SNAPSHOT(s, apu_clock);
+    SNAPSHOT(s, fs_next);
+    SNAPSHOT(s, fs_step);
+    SNAPSHOT(s, gains);
+    SNAPSHOT(s, blip);
+    SNAPSHOT(s, integrator);
+    SNAPSHOT(s, blip_extent);
+    SNAPSHOT(s, blip_time);
+    SNAPSHOT(s, blip_frac);
+    SNAPSHOT(s, flush_at);
+}
+
+void apu_set_sample_sink(void (*fn)(const int16_t *samples, int frames)) {
+    sink_fn = fn;
+}
+
+bool apu_set_channel_sink(void (*fn)(int channel, const int16_t *samples,
+    int frames))
+{
+    channel_sink_fn = fn;
+    if (fn == NULL) {
+        SDL_free(stem_blip);
+        stem_blip = NULL;
+        return true;
+    }
+    if (stem_blip != NULL)
+        return true;
+    stem_blip = SDL_calloc(NUM_CHANNELS, sizeof(*stem_blip));
+    if (stem_blip == NULL) {
+        channel_sink_fn = NULL;
+        return false;
+    }
+    SDL_memset(stem_integrator, 0, sizeof(stem_integrator));
+    /* Starts each channel from its current level. */
+    catch_up();
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        for (int side = 0; side < 2; side++)
+            add_delta(stem_blip[i][side], apu_clock, chans[i].out * gains[i][side]);
+    }
+    return true;
+}
+
+void apu_tick(void)
+{
+    apu_clock += T_M_RATIO;
+    if (apu_clock >= flush_at)
+        apu_flush();
+}
+
+/* Integrates the first n samples of buf into out_samples, and removes them.
+   silent is set when the buffers hold no deltas. Returns whether the samples
+   were all 0 without integration. */
+static bool read_samples(int32_t buf[2][BLIP_SIZE + KERNEL_WIDTH],
+    int64_t acc_state[2], int n, bool silent)
+{
+    bool idle = true;
+    for (int side = 0; side < 2; side++) {
+        int64_t acc = acc_state[side];
+        /* Nothing to add, and too little left to leak away. */
+        if (silent && acc >= 0 && acc < (1 << BASS_SHIFT)) {
+            for (int i = 0; i < n; i++)
+                out_samples[i * 2 + side] = 0;
+            continue;
+        }
+        idle = false;
+        for (int i = 0; i < n; i++) {
+            acc += buf[side][i];
+            int32_t sample = (int32_t)(acc >> KERNEL_UNIT);
+            acc -= acc >> BASS_SHIFT;
+            out_samples[i * 2 + side] = (int16_t)SDL_clamp(sample, -32768, 32767);
+        }
+        acc_state[side] = acc;
+        if (silent)
+            continue;
+        SDL_memmove(buf[side], buf[side] + n,
+            (BLIP_SIZE + KERNEL_WIDTH - n) * sizeof(int32_t));
+        SDL_memset(buf[side] + BLIP_SIZE + KERNEL_WIDTH - n, 0,
+            n * sizeof(int32_t));
+    }
+    return idle;
+}
+
+void apu_flush(void)
+{
+    catch_up();
+    uint64_t pos = (apu_clock - blip_time) * blip_factor + blip_frac;
+    int n = (int)SDL_min(pos >> 32, BLIP_SIZE);
+    blip_time = apu_clock;
+    blip_frac = pos & 0xFFFFFFFF;
+    flush_at = apu_clock + flush_cycles;
+    bool silent = blip_extent == 0;
+    bool idle = read_samples(blip, integrator, n, silent);
+    if (sink_fn != NULL && n > 0)
+        sink_fn(out_samples, n);
+    for (int i = 0; stem_blip != NULL && i < NUM_CHANNELS; i++) {
+        read_samples(stem_blip[i], stem_integrator[i], n, silent);
+        if (n > 0)
+            channel_sink_fn(i, out_samples, n);
+    }
+    blip_extent = SDL_max(blip_extent - n, 0);
+    SDL_LockMutex(stats_lock);
+    stats.flushes++;
+    if (idle)
+        stats.idle_flushes++;
+    SDL_UnlockMutex(stats_lock);
+}
+
+apu_stats apu_get_stats(void)
+{
+    SDL_LockMutex(stats_lock);
+    apu_stats copy = stats;
+    SDL_UnlockMutex(stats_lock);
+    return copy;
+}
+
+/* Channels */
+
+static int channel_output(int idx)
+{
+    const apu_channel *c = &chans[idx];
+    if (!c->on)
+        return 0;
+    switch (idx) {
+        case CH_SQUARE1:
+        case CH_SQUARE2: {
+            int duty = (idx == CH_SQUARE1 ? REG(NR11_REG) : REG(NR21_REG)) >> 6;
+            return get_bit(duty_patterns[duty], 7 - c->pos) ? c->volume : 0;
+        }
+        case CH_WAVE:
+            return c->sample >> wave_shifts[get_bits(REG(NR32_REG), 6, 5)];
+        default:
+            return (c->lfsr & 1) ? 0 : c->volume;
+    }
+}
+
+static void set_output(int idx, uint64_t t)
+{
+    apu_channel *c = &chans[idx];
+    int out = channel_output(idx);
+    if (out == c->out)
+        return;
+    for (int side = 0; side < 2; side++) {
+        if (gains[idx][side] != 0)
+            add_channel_delta(idx, side, t, (out - c->out) * gains[idx][side]);
+    }
+    c->out = out;
+}
+
+static void disable(int idx, uint64_t t)
+{
+    chans[idx].on = false;
+    set_output(idx, t);
+}
+
+static uint64_t square_period(const apu_channel *c) {
+    return (uint64_t)(2048 - c->freq) * 4;
+}
+static uint64_t wave_period(const apu_channel *c) {
+    return (uint64_t)(2048 - c->freq) * 2;
+}
+/* NEVER for the shifts that stop the LFSR. */
+static uint64_t noise_period(void)
+{
+    byte nr43 = REG(NR43_REG);
+    int shift = get_hi_nibble(nr43);
+    int divisor = nr43 & 0x07;
+    if (shift >= 14)
+        return NEVER;
+    return (uint64_t)(divisor == 0 ? 8 : divisor * 16) << shift;
+}
+
+static byte wave_nibble(int pos)
+{
+    byte b = regs[WAVE_RAM_START - NR10_REG + pos / 2];
+    return (pos & 1) ? get_lo_nibble(b) : get_hi_nibble(b);
+}
+
+static void step_lfsr(apu_channel *c)
+{
+    int x = (c->lfsr ^ (c->lfsr >> 1)) & 1;
+    c->lfsr = (c->lfsr >> 1) | (x << 14);
+    if (get_bit(REG(NR43_REG), 3))
+        c->lfsr = (c->lfsr & ~0x40) | (x << 6);
+}
+
+/* Whether the channel's output stays at 0 until a register write or a
+   frame sequencer step, both of which catch up first. */
+static bool is_muted(int idx)
+{
+    const apu_channel *c = &chans[idx];
+    if (c->out != 0)
+        return false;
+    if (idx == CH_WAVE)
+        return get_bits(REG(NR32_REG), 6, 5) == 0;
+    return c->volume == 0;
+}
+
+/* Runs a muted channel forward without adding steps to the buffer. The
+   waveform position is still kept, since a later write may make it heard. */
+static void skip_channel(int idx, uint64_t end)
+{
+    apu_channel *c = &chans[idx];
+    if (idx == CH_NOISE) {
+        uint64_t period = noise_period();
+        if (period == NEVER) {
+            step_lfsr(c);
+            c->next = NEVER;
+            return;
+        }
+        uint64_t steps = (end - c->next) / period + 1;
+        c->next += steps * period;
+        /* The LFSR repeats every 2^15 - 1 steps, or 2^7 - 1 in 7-bit mode
+           once the 8 bits above the short register are refilled. */
+        uint64_t cycle = get_bit(REG(NR43_REG), 3) ? 127 : 32767;
+        if (steps >= cycle + 8)
+            steps = (steps - 8) % cycle + 8;
+        while (steps-- > 0)
+            step_lfsr(c);
+        return;
+    }
+    uint64_t period = idx == CH_WAVE ? wave_period(c) : square_period(c);
+    uint64_t steps = (end - c->next) / period + 1;
+    c->next += steps * period;
+    if (idx == CH_WAVE) {
+        c->pos = (int)((c->pos + steps) & 31);
+        c->sample = wave_nibble(c->pos);
+    }
+    else
+        c->pos = (int)((c->pos + steps) & 7);
+}
+
+static void run_channel(int idx, uint64_t end)
+{
+    apu_channel *c = &chans[idx];
+    if (!c->on || c->next > end)
+        return;
+    if (is_muted(idx)) {
+        skip_channel(idx, end);
+        return;
+    }
+    while (c->next <= end) {
+        uint64_t t = c->next;
+        switch (idx) {
+            case CH_SQUARE1:
+            case CH_SQUARE2:
+                c->pos = (c->pos + 1) & 7;
+                c->next += square_period(c);
+                break;
+            case CH_WAVE:
+                c->pos = (c->pos + 1) & 31;
+                c->sample = wave_nibble(c->pos);
+                c->next += wave_period(c);
+                break;
+            default: {
+                step_lfsr(c);
+                uint64_t period = noise_period();
+                c->next = period == NEVER ? NEVER : c->next + period;
+                break;
+            }
+        }
+        set_output(idx, t);
+    }
+}
+
+static void run_channels(uint64_t end)
+{
+    for (int i = 0; i < NUM_CHANNELS; i++)
+        run_channel(i, end);
+}
+
+/* Frame sequencer */
+
+static int sweep_calc(uint64_t t)
+{
+    byte nr10 = REG(NR10_REG);
+    int delta = sweep_shadow >> (nr10 & 0x07);
+    int freq = sweep_shadow + delta;
+    if (get_bit(nr10, 3)) {
+        freq = sweep_shadow - delta;
+        sweep_negated = true;
+    }
+    if (freq > 2047)
+        disable(CH_SQUARE1, t);
+    return freq;
+}
+
+static void clock_sweep(uint64_t t)
+{
+    byte nr10 = REG(NR10_REG);
+    int period = get_bits(nr10, 6, 4);
+    if (--sweep_timer > 0)
+        return;
+    sweep_timer = period != 0 ? period : 8;
+    if (!sweep_enabled || period == 0)
+        return;
+    int freq = sweep_calc(t);
+    if (freq <= 2047 && (nr10 & 0x07) != 0) {
+        sweep_shadow = freq;
+        chans[CH_SQUARE1].freq = freq;
+        REG(NR13_REG) = get_lo_byte(freq);
+        REG(NR14_REG) = overlay_masked(REG(NR14_REG), freq >> 8, 0x07);
+        sweep_calc(t);
+    }
+}
+
+static void clock_lengths(uint64_t t)
+{
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        apu_channel *c = &chans[i];
+        if (c->length_enabled && c->length > 0 && --c->length == 0)
+            disable(i, t);
+    }
+}
+
+static void clock_envelopes(uint64_t t)
+{
+    static const uint16_t env_regs[] = { NR12_REG, NR22_REG, 0, NR42_REG };
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        if (i == CH_WAVE)
+            continue;
+        apu_channel *c = &chans[i];
+        byte env = REG(env_regs[i]);
+        int period = env & 0x07;
+        if (period == 0 || --c->env_timer > 0)
+            continue;
+        c->env_timer = period;
+        if (get_bit(env, 3) && c->volume < 15)
+            c->volume++;
+        else if (!get_bit(env, 3) && c->volume > 0)
+            c->volume--;
+        set_output(i, t);
+    }
+}
+
+static void step_frame_sequencer(uint64_t t)
+{
+    if (!power)
+        return;
+    int step = fs_step;
+    fs_step = (fs_step + 1) & 7;
+    if ((step & 1) == 0)
+        clock_lengths(t);
+    if (step == 2 || step == 6)
+        clock_sweep(t);
+    if (step == 7)
+        clock_envelopes(t);
+}
+
+/* Runs the channels and the frame sequencer up to the current cycle. */
+static void catch_up(void)
+{
+    while (fs_next <= apu_clock) {
+        run_channels(fs_next);
+        step_frame_sequencer(fs_next);
+        fs_next += FS_PERIOD;
+    }
+    run_channels(apu_clock);
+}
+
+void apu_div_reset(uint64_t counter)
+{
+    catch_up();
+    if (get_bit(counter, 12))
+        step_frame_sequencer(apu_clock);
+    fs_next = apu_clock + FS_PERIOD;
+}
+
+/* Registers */
+
+static void trigger(int idx)
+{
+    static const uint16_t env_regs[] = { NR12_REG, NR22_REG, 0, NR42_REG };
+    apu_channel *c = &chans[idx];
+    uint64_t t = apu_clock;
+    c->on = c->dac;
+    if (c->length == 0) {
+        c->length = idx == CH_WAVE ? 256 : 64;
+        /* Enabling the length counter in the first half of a length period
+           clocks it once. */
+        if (c->length_enabled && (fs_step & 1))
+            c->length--;
+    }
+
+    switch (idx) {
+        case CH_SQUARE1:
+        case CH_SQUARE2:
+            c->next = t + square_period(c);
+            break;
+        case CH_WAVE:
+            c->pos = 0;
+            c->next = t + wave_period(c);
+            break;
+        default: {
+            c->lfsr = 0x7FFF;
+            uint64_t period = noise_period();
+            c->next = period == NEVER ? NEVER : t + period;
+            break;
+        }
+    }
+    if (idx != CH_WAVE) {
+        byte env = REG(env_regs[idx]);
+        c->volume = get_hi_nibble(env);
+        c->env_timer = (env & 0x07) != 0 ? (env & 0x07) : 8;
+    }
+    if (idx == CH_SQUARE1) {
+        byte nr10 = REG(NR10_REG);
+        int period = get_bits(nr10, 6, 4);
+        sweep_shadow = c->freq;
+        sweep_timer = period != 0 ? period : 8;
+        sweep_enabled = period != 0 || (nr10 & 0x07) != 0;
+        sweep_negated = false;
+        if ((nr10 & 0x07) != 0)
+            sweep_calc(t);
+    }
+    set_output(idx, t);
+}
+
+static void write_nrx2(int idx, byte val)
+{
+    chans[idx].dac = (val & 0xF8) != 0;
+    if (!chans[idx].dac)
+        disable(idx, apu_clock);
+}
+
+static void write_nrx4(int idx, byte val)
+{
+    apu_channel *c = &chans[idx];
+    bool was_enabled = c->length_enabled;
+    c->length_enabled = get_bit(val, 6);
+    if (idx != CH_NOISE)
+        c->freq = (c->freq & 0xFF) | ((val & 0x07) << 8);
+    /* Enabling the length counter when the next step does not clock it
+       clocks it once. */
+    if (!was_enabled && c->length_enabled && (fs_step & 1) && c->length > 0) {
+        if (--c->length == 0 && !get_bit(val, 7))
+            disable(idx, apu_clock);
+    }
+    if (get_bit(val, 7))
+        trigger(idx);
+}
+
+static void write_nr51(byte nr50, byte nr51)
+{
+    int volumes[2] = { get_bits(nr50, 6, 4) + 1, (nr50 & 0x07) + 1 };
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        for (int side = 0; side < 2; side++) {
+            bool panned = get_bit(nr51, side == 0 ? 4 + i : i);
+            int gain = panned ? volumes[side] * AMP_UNIT : 0;
+            if (gain != gains[i][side] && chans[i].out != 0)
+                add_channel_delta(i, side, apu_clock,
+                    chans[i].out * (gain - gains[i][side]));
+            gains[i][side] = gain;
+        }
+    }
+}
+
+static void set_power(bool on)
+{
+    if (on == power)
+        return;
+    if (on) {
+        power = true;
+        fs_step = 0;
+        for (int i = 0; i < NUM_CHANNELS; i++)
+            chans[i].pos = 0;
+        chans[CH_WAVE].sample = 0;
+        return;
+    }
+    /* Everything but wave RAM is cleared, except for the length counters
+       on the DMG. */
+    for (int i = 0; i < NUM_CHANNELS; i++) {
+        disable(i, apu_clock);
+        int length = chans[i].length;
+        chans[i] = (apu_channel){ .length = length, .next = NEVER };
+    }
+    SDL_memset(regs, 0, NR52_REG - NR10_REG);
+    write_nr51(0, 0);
+    sweep_enabled = sweep_negated = false;
+    power = false;
+}
+
+byte apu_read(uint16_t addr)
+{
+    if (addr >= WAVE_RAM_START) {
+        /* While the wave channel plays, wave RAM accesses go to the byte
+           being played. */
+        if (chans[CH_WAVE].on) {
+            catch_up();
+            addr = WAVE_RAM_START + chans[CH_WAVE].pos / 2;
+        }
+        return REG(addr);
+    }
+    if (addr == NR52_REG) {
+        catch_up();
+        byte status = 0x70 | (power << 7);
+        for (int i = 0; i < NUM_CHANNELS; i++)
+            status |= chans[i].on << i;
+        return status;
+    }
+    return REG(addr) | read_masks[addr - NR10_REG];
+}
+
+void apu_write(uint16_t addr, byte val)
+{
+    catch_up();
+    if (addr >= WAVE_RAM_START) {
+        if (chans[CH_WAVE].on)
+            addr = WAVE_RAM_START + chans[CH_WAVE].pos / 2;
+        REG(addr) = val;
+        return;
+    }
+    if (addr == NR52_REG) {
+        set_power(get_bit(val, 7));
+        return;
+    }
+    if (!power) {
+        /* Only the length counters can be written while off. */
+        switch (addr) {
+            case NR11_REG: chans[CH_SQUARE1].length = 64 - (val & 0x3F); break;
+            case NR21_REG: chans[CH_SQUARE2].length = 64 - (val & 0x3F); break;
+            case NR31_REG: chans[CH_WAVE].length = 256 - val;            break;
+            case NR41_REG: chans[CH_NOISE].length = 64 - (val & 0x3F);   break;
+        }
+        return;
+    }
+
+    byte old = REG(addr);
+    REG(addr) = val;
+    switch (addr) {
+        case NR10_REG:
+            if (sweep_negated && get_bit(old, 3) && !get_bit(val, 3))
+                disable(CH_SQUARE1, apu_clock);
+            break;
+        case NR11_REG: chans[CH_SQUARE1].length = 64 - (val & 0x3F); break;
+        case NR21_REG: chans[CH_SQUARE2].length = 64 - (val & 0x3F); break;
+        case NR31_REG: chans[CH_WAVE].length = 256 - val;            break;
+        case NR41_REG: chans[CH_NOISE].length = 64 - (val & 0x3F);   break;
+        case NR12_REG: write_nrx2(CH_SQUARE1, val); break;
+        case NR22_REG: write_nrx2(CH_SQUARE2, val); break;
+        case NR42_REG: write_nrx2(CH_NOISE, val);   break;
+        case NR30_REG:
+            chans[CH_WAVE].dac = get_bit(val, 7);
+            if (!chans[CH_WAVE].dac)
+                disable(CH_WAVE, apu_clock);
+            break;
+        case NR13_REG: chans[CH_SQUARE1].freq = set_lo_byte(chans[CH_SQUARE1].freq, val); break;
+        case NR23_REG: chans[CH_SQUARE2].freq = set_lo_byte(chans[CH_SQUARE2].freq, val); break;
+        case NR33_REG: chans[CH_WAVE].freq = set_lo_byte(chans[CH_WAVE].freq, val);       break;
+        case NR14_REG: write_nrx4(CH_SQUARE1, val); break;
+        case NR24_REG: write_nrx4(CH_SQUARE2, val); break;
+        case NR34_REG: write_nrx4(CH_WAVE, val);    break;
+        case NR44_REG: write_nrx4(CH_NOISE, val);   break;
+        case NR32_REG:
+            set_output(CH_WAVE, apu_clock);
+            break;
+        case NR43_REG: {
+            /* A stopped LFSR restarts with the new period. */
+            apu_channel *c = &chans[CH_NOISE];
+            if (c->next == NEVER && noise_period() != NEVER)
+                c->next = apu_clock + noise_period();
+            break;
+        }
+        case NR50_REG: write_nr51(val, REG(NR51_REG)); break;
+        case NR51_REG: write_nr51(REG(NR50_REG), val); break;
+    }
+}
@@ -0,0 +1,45 @@
+#pragma once
+#include "byte.h"
+#include "snapshot.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Audio processing unit. Channels are not stepped every M-cycle -- the APU
+   catches up to the current cycle when a sound register is accessed or the
+   sample buffer is due to be emptied, and turns each change of a channel's
+   output into a band-limited step in the sample buffer. */
+
+#define APU_DEFAULT_RATE 48000
+/* One sample per M-cycle, for resampling on the host. */
+#define APU_NATIVE_RATE 1048576
+
+typedef struct {
+    uint64_t flushes;      /* Of the samples completed for the sink. */
+    uint64_t idle_flushes; /* Constant output, filled in without synthesis. */
+} apu_stats;
+
+/* rate is the output sample rate in Hz. */
+bool apu_init(int rate);
+void apu_tick(void);
+void apu_snapshot(snapshot *s);
+
+/* fn is called on the emulation thread with interleaved stereo samples,
+   every few milliseconds of emulated time. */
+void apu_set_sample_sink(void (*fn)(const int16_t *samples, int frames));
+/* Like the sample sink, but with each channel (0-3) as it is mixed into the
+   output, panning and master volume included. Buffers for the channels are
+   allocated while it is set; they are not part of snapshots. */
+bool apu_set_channel_sink(void (*fn)(int channel, const int16_t *samples,
+    int frames));
+/* Catches up and passes the samples completed so far to the sink. */
+void apu_flush(void);
+
+/* Safe to call from any thread. */
+apu_stats apu_get_stats(void);
+
+/* Called by the timer before DIV is reset, with the old internal counter. */
+void apu_div_reset(uint64_t counter);
+
+/* NR10 through NR52, and wave RAM. */
+byte apu_read(uint16_t addr);
+void apu_write(uint16_t addr, byte val);
@@ -0,0 +1,230 @@
+#include "audio.h"
+#include <SDL3/SDL.h>
+
+/* Audio output through an SDL audio stream. */
+
+#define FRAME_BYTES (2 * (int)sizeof(int16_t))
+
+/* Single-producer, single-consumer ring of stereo frames from the emulation
+   thread to the audio device callback. Indices run freely and are masked on
+   access. */
+static int16_t *ring;
+static unsigned int ring_size;
+static unsigned int ring_mask;
+static SDL_AtomicInt ring_head;
+static SDL_AtomicInt ring_tail;
+static int target_fill;
+/* Signaled by the callback once the fill is down to the target, when the
+   emulation thread waits for it. */
+static SDL_Semaphore *drained;
+static SDL_AtomicInt producer_waiting;
+static SDL_AtomicInt sync_to_device;
+
+static SDL_AudioStream *stream;
+/* Callback only. */
+static double smoothed_fill;
+static double integral;
+static double applied_ratio;
+static bool started;
+
+static SDL_Mutex *stats_lock;
+static audio_stats stats;
+
+static void SDLCALL on_audio_request(void *userdata, SDL_AudioStream *stream,
+    int additional_amount, int total_amount);
+
+bool audio_init(int rate, int latency_ms)
+{
+    /* Room for twice the target fill. */
+    target_fill = SDL_max(rate * latency_ms / 1000, 256);
+    ring_size = 1;
+    while (ring_size < (unsigned int)target_fill * 2)
+        ring_size <<= 1;
+    ring_mask = ring_size - 1;
+    ring = SDL_calloc(ring_size, FRAME_BYTES);
+    stats_lock = SDL_CreateMutex();
+    drained = SDL_CreateSemaphore(0);
+    if (ring == NULL || stats_lock == NULL || drained == NULL)
+        goto failure;
+    SDL_SetAtomicInt(&producer_waiting, 0);
+    SDL_SetAtomicInt(&sync_to_device, 0);
+    SDL_SetAtomicInt(&ring_head, 0);
+    SDL_SetAtomicInt(&ring_tail, 0);
+    smoothed_fill = target_fill;
+    integral = 0;
+    applied_ratio = 1.0;
+    started = false;
+    stats = (audio_stats){
+        .capacity = ring_size, .target = target_fill, .ratio = 1.0,
+        .fill_min = ring_size
+    };
+
+    if (!SDL_InitSubSystem(SDL_INIT_AUDIO))
+        goto failure;
+    SDL_AudioSpec spec = { SDL_AUDIO_S16, 2, rate };
+    stream = SDL_OpenAudioDeviceStream(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK,
+        &spec, &on_audio_request, NULL);
+    if (stream == NULL) {
+        SDL_QuitSubSystem(SDL_INIT_AUDIO);
+        goto failure;
+    }
+    return SDL_ResumeAudioStreamDevice(stream);
+failure:
+    SDL_free(ring);
+    ring = NULL;
+    if (stats_lock != NULL)
+        SDL_DestroyMutex(stats_lock);
+    stats_lock = NULL;
+    if (drained != NULL)
+        SDL_DestroySemaphore(drained);
+    drained = NULL;
+    return false;
+}
+
+void audio_deinit(void)
+{
+    if (stream == NULL)
+        return;
+    SDL_DestroyAudioStream(stream);
+    stream = NULL;
+    SDL_QuitSubSystem(SDL_INIT_AUDIO);
+    SDL_DestroyMutex(stats_lock);
+    stats_lock = NULL;
+    SDL_DestroySemaphore(drained);
+    drained = NULL;
+    SDL_free(ring);
+    ring = NULL;
+}
+
+void audio_push(const int16_t *samples, int frames)
+{
+    unsigned int head = SDL_GetAtomicInt(&ring_head);
+    unsigned int tail = SDL_GetAtomicInt(&ring_tail);
+    int space = ring_size - (head - tail);
+    int n = SDL_min(frames, space);
+    for (int done = 0; done < n; ) {
+        unsigned int pos = (head + done) & ring_mask;
+        int run = SDL_min(n - done, (int)(ring_size - pos));
+        SDL_memcpy(&ring[pos * 2], &samples[done * 2], run * FRAME_BYTES);
+        done += run;
+    }
+    SDL_SetAtomicInt(&ring_head, head + n);
+
+    if (n < frames) {
+        SDL_LockMutex(stats_lock);
+        stats.dropped_frames += frames - n;
+        SDL_UnlockMutex(stats_lock);
+    }
+}
+
+void audio_set_sync(bool sync)
+{
+    SDL_SetAtomicInt(&sync_to_device, sync);
+}
+
+bool audio_wait_drained(int timeout_ms)
+{
+    Uint64 deadline = SDL_GetTicksNS() + (Uint64)timeout_ms * 1000000ull;
+    while (true) {
+        SDL_SetAtomicInt(&producer_waiting, 1);
+        unsigned int head = SDL_GetAtomicInt(&ring_head);
+        unsigned int tail = SDL_GetAtomicInt(&ring_tail);
+        if ((int)(head - tail) <= target_fill) {
+            SDL_SetAtomicInt(&producer_waiting, 0);
+            return true;
+        }
+        Uint64 now = SDL_GetTicksNS();
+        if (now >= deadline) {
+            SDL_SetAtomicInt(&producer_waiting, 0);
+            return false;
+        }
+        SDL_WaitSemaphoreTimeout(drained,
+            (Sint32)((deadline - now + 999999) / 1000000));
+    }
+}
+
+/* Sets the drain rate from the fill: faster when above the target, slower
+   when below. The integral term takes over the steady clock difference, so
+   the fill settles at the target rather than off it. The fill is smoothed,
+   since it jumps by a whole push or drain at a time. */
+static void update_ratio(int fill)
+{
+    smoothed_fill += (fill - smoothed_fill) * 0.05;
+    double error = (smoothed_fill - target_fill) / target_fill;
+    integral = SDL_clamp(integral + error * 0.002, -1.0, 1.0);
+    double ratio = 1.0 + AUDIO_MAX_DRIFT * SDL_clamp(error + integral, -1.0, 1.0);
+    /* Rounds off changes too small to matter. */
+    if (SDL_fabs(ratio - applied_ratio) >= 0.0001) {
+        SDL_SetAudioStreamFrequencyRatio(stream, (float)ratio);
+        applied_ratio = ratio;
+    }
+}
+
+static void SDLCALL on_audio_request(void *userdata, SDL_AudioStream *stream,
+    int additional_amount, int total_amount)
+{
+    int frames = additional_amount / FRAME_BYTES;
+    if (frames <= 0)
+        return;
+    unsigned int tail = SDL_GetAtomicInt(&ring_tail);
+    unsigned int head = SDL_GetAtomicInt(&ring_head);
+    int fill = head - tail;
+    /* Nothing is played until the ring first reaches its target. */
+    if (!started && fill < target_fill)
+        fill = 0;
+    else
+        started = true;
+
+    int n = SDL_min(frames, fill);
+    for (int done = 0; done < n; ) {
+        unsigned int pos = (tail + done) & ring_mask;
+        int run = SDL_min(n - done, (int)(ring_size - pos));
+        SDL_PutAudioStreamData(stream, &ring[pos * 2], run * FRAME_BYTES);
+        done += run;
+    }
+    SDL_SetAtomicInt(&ring_tail, tail + n);
+
+    int silent = frames - n;
+    if (silent > 0) {
+        static const int16_t silence[256 * 2];
+        for (int done = 0; done < silent; ) {
+            int run = SDL_min(silent - done, 256);
+            SDL_PutAudioStreamData(stream, silence, run * FRAME_BYTES);
+            done += run;
+        }
+    }
+    if (SDL_GetAtomicInt(&producer_waiting) && fill - n <= target_fill &&
+        SDL_CompareAndSwapAtomicInt(&producer_waiting, 1, 0))
+        SDL_SignalSemaphore(drained);
+
+    if (SDL_GetAtomicInt(&sync_to_device)) {
+        if (applied_ratio != 1.0) {
+            SDL_SetAudioStreamFrequencyRatio(stream, 1.0f);
+            applied_ratio = 1.0;
+        }
+    }
+    else if (started)
+        update_ratio(fill);
+
+    SDL_LockMutex(stats_lock);
+    stats.fill = fill;
+    stats.fill_min = SDL_min(stats.fill_min, fill);
+    stats.fill_max = SDL_max(stats.fill_max, fill);
+    stats.ratio = applied_ratio;
+    if (started && silent > 0) {
+        stats.underruns++;
+        stats.silent_frames += silent;
+    }
+    SDL_UnlockMutex(stats_lock);
+}
+
+audio_stats audio_get_stats(void)
+{
+    if (stats_lock == NULL)
+        return (audio_stats){ 0 };
+    SDL_LockMutex(stats_lock);
+    audio_stats copy = stats;
+    stats.fill_min = stats.fill_max = stats.fill;
+    SDL_UnlockMutex(stats_lock);
+    return copy;
+}
@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Plays the APU output. The emulation thread pushes samples into a
+   single-producer, single-consumer ring that the audio device drains, and the
+   rate it is drained at is adjusted by up to AUDIO_MAX_DRIFT to hold the fill
+   at a target of at most half the ring, absorbing the drift between the
+   emulated and host clocks without audible pitch changes. */
+
+#define AUDIO_MAX_DRIFT 0.005
+
+typedef struct {
+    int capacity;            /* Frames. */
+    int target;
+    int fill;                /* Frames queued when last drained. */
+    int fill_min, fill_max;  /* Since the last call to audio_get_stats. */
+    double ratio;            /* Drain rate relative to the sample rate. */
+    uint64_t underruns;      /* Drains that found too few frames. */
+    uint64_t silent_frames;  /* Played instead of missing ones. */
+    uint64_t dropped_frames; /* Pushed while the ring was full. */
+} audio_stats;
+
+/* rate is the sample rate of the pushed frames, latency_ms the target fill
+   of the ring. */
+bool audio_init(int rate, int latency_ms);
+void audio_deinit(void);
+/* Called by the emulation thread with interleaved stereo samples. */
+void audio_push(const int16_t *samples, int frames);
+/* With sync set, the device clock is the master: the drain rate stays at the
+   sample rate, and the emulation thread keeps pace by waiting for the ring
+   to drain. */
+void audio_set_sync(bool sync);
+/* Blocks until the fill is down to the target, or for at most timeout_ms.
+   Returns false on timeout. */
+bool audio_wait_drained(int timeout_ms);
+audio_stats audio_get_stats(void);
@@ -0,0 +1,352 @@
+#include "audio_capture.h"
+#include "byte.h"
+#include <SDL3/SDL.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define NUM_STREAMS (1 + CAPTURE_NUM_STEMS)
+#define CHUNK_BYTES (64 * 1024)
+#define NUM_CHUNKS 16
+#define WAV_HEADER_LEN 44
+#define FRAME_BYTES 4
+
+static const char *stem_names[CAPTURE_NUM_STEMS] = {
+    "square1", "square2", "wave", "noise"
+};
+
+typedef struct {
+    FILE *file;
+    char *path;
+    uint64_t data_bytes;
+} capture_stream;
+
+static audio_capture_args args;
+static capture_stream streams[NUM_STREAMS];
+static int num_streams;
+static bool write_failed;
+
+/* Samples for stream, in file byte order. */
+typedef struct {
+    byte *data;
+    size_t len;
+    int stream;
+} capture_chunk;
+
+/* Ring of queued chunks. Each slot keeps a buffer: the producer swaps the
+   chunk it filled into the slot at head before queuing it, and takes the
+   slot's written buffer in return. */
+static capture_chunk slots[NUM_CHUNKS];
+static int head, tail, queued;
+/* Chunks being filled, one per stream. Producer only. */
+static capture_chunk filling[NUM_STREAMS];
+static SDL_Mutex *lock;
+static SDL_Condition *has_chunks;
+static SDL_Condition *has_space;
+static bool stopping;
+
+static SDL_Thread *writer;
+static audio_capture_stats stats;
+static bool started = false;
+
+static int loop_writer(void *data);
+
+bool audio_capture_parse_format(const char *name, capture_format *format)
+{
+    if (strcmp(name, "wav") == 0)
+        *format = CAPTURE_FORMAT_WAV;
+    else if (strcmp(name, "raw") == 0)
+        *format = CAPTURE_FORMAT_RAW;
+    else {
+        SDL_SetError("Unknown audio capture format %s", name);
+        return false;
+    }
+    return true;
+}
+
+/* PATH with -NAME inserted before the extension, if any. */
+static char *stem_path(const char *path, const char *name)
+{
+    const char *ext = strrchr(path, '.');
+    const char *sep = strrchr(path, '/');
+    const char *back_sep = strrchr(path, '\\');
+    if (back_sep != NULL && (sep == NULL || back_sep > sep))
+        sep = back_sep;
+    if (ext == NULL || (sep != NULL && ext < sep))
+        ext = path + strlen(path);
+    size_t len = strlen(path) + strlen(name) + 2;
+    char *out = SDL_malloc(len);
+    if (out != NULL)
+        snprintf(out, len, "%.*s-%s%s", (int)(ext - path), path, name, ext);
+    return out;
+}
+
+static void put_le16(byte *dst, uint16_t val)
+{
+    dst[0] = get_lo_byte(val);
+    dst[1] = get_hi_byte(val);
+}
+
+static void put_le32(byte *dst, uint32_t val)
+{
+    put_le16(dst, (uint16_t)val);
+    put_le16(dst + 2, (uint16_t)(val >> 16));
+}
+
+/* data_bytes is UINT32_MAX when unknown. */
+static void make_wav_header(byte header[WAV_HEADER_LEN], uint32_t data_bytes)
+{
+    memcpy(header, "RIFF", 4);
+    put_le32(header + 4, data_bytes == UINT32_MAX ? UINT32_MAX :
+        data_bytes + WAV_HEADER_LEN - 8);
+    memcpy(header + 8, "WAVEfmt ", 8);
+    put_le32(header + 16, 16);
+    put_le16(header + 20, 1); /* PCM */
+    put_le16(header + 22, 2);
+    put_le32(header + 24, args.rate);
+    put_le32(header + 28, args.rate * FRAME_BYTES);
+    put_le16(header + 32, FRAME_BYTES);
+    put_le16(header + 34, 16);
+    memcpy(header + 36, "data", 4);
+    put_le32(header + 40, data_bytes);
+}
+
+static void close_streams(void)
+{
+    for (int i = 0; i < num_streams; i++) {
+        if (streams[i].file != NULL && streams[i].file != stdout)
+            fclose(streams[i].file);
+        else if (streams[i].file == stdout)
+            fflush(stdout);
+        SDL_free(streams[i].path);
+        streams[i] = (capture_stream){ 0 };
+    }
+    num_streams = 0;
+}
+
+static void free_chunks(void)
+{
+    SDL_DestroyCondition(has_space);
+    SDL_DestroyCondition(has_chunks);
+    SDL_DestroyMutex(lock);
+    has_space = has_chunks = NULL;
+    lock = NULL;
+    for (int i = 0; i < NUM_CHUNKS; i++) {
+        SDL_free(slots[i].data);
+        slots[i].data = NULL;
+    }
+    for (int i = 0; i < NUM_STREAMS; i++) {
+        SDL_free(filling[i].data);
+        filling[i].data = NULL;
+    }
+}
+
+bool audio_capture_start(audio_capture_args _args)
+{
+    args = _args;
+    write_failed = false;
+    stats = (audio_capture_stats){ 0 };
+    head = tail = queued = 0;
+    stopping = false;
+
+    bool to_stdout = strcmp(args.path, "-") == 0;
+    if (to_stdout && args.stems) {
+        SDL_SetError("Stems cannot be written to standard output");
+        return false;
+    }
+    num_streams = args.stems ? NUM_STREAMS : 1;
+    for (int i = 0; i < num_streams; i++) {
+        streams[i].path = i == 0 ? SDL_strdup(args.path) :
+            stem_path(args.path, stem_names[i - 1]);
+        if (streams[i].path == NULL)
+            goto failure;
+        streams[i].file = to_stdout ? stdout : fopen(streams[i].path, "wb");
+        if (streams[i].file == NULL) {
+            SDL_SetError("Could not open %s", streams[i].path);
+            goto failure;
+        }
+        /* Writes are already batched. */
+        setvbuf(streams[i].file, NULL, _IONBF, 0);
+        if (args.format == CAPTURE_FORMAT_WAV) {
+            /* The lengths are filled in when stopping, if the file can seek. */
+            byte header[WAV_HEADER_LEN];
+            make_wav_header(header, to_stdout ? UINT32_MAX : 0);
+            if (fwrite(header, 1, sizeof(header), streams[i].file) != sizeof(header)) {
+                SDL_SetError("Could not write to %s", streams[i].path);
+                goto failure;
+            }
+        }
+    }
+
+    for (int i = 0; i < NUM_CHUNKS; i++) {
+        if ((slots[i].data = SDL_malloc(CHUNK_BYTES)) == NULL)
+            goto failure;
+    }
+    for (int i = 0; i < num_streams; i++) {
+        filling[i] = (capture_chunk){ SDL_malloc(CHUNK_BYTES), 0, i };
+        if (filling[i].data == NULL)
+            goto failure;
+    }
+    lock = SDL_CreateMutex();
+    has_chunks = SDL_CreateCondition();
+    has_space = SDL_CreateCondition();
+    if (lock == NULL || has_chunks == NULL || has_space == NULL)
+        goto failure;
+
+    writer = SDL_CreateThread(&loop_writer, "MyDMG audio capture", NULL);
+    if (writer == NULL)
+        goto failure;
+    started = true;
+    return true;
+failure:
+    close_streams();
+    free_chunks();
+    return false;
+}
+
+static void queue_chunk(int stream)
+{
+    SDL_LockMutex(lock);
+    if (queued == NUM_CHUNKS) {
+        Uint64 start = SDL_GetTicksNS();
+        while (queued == NUM_CHUNKS)
+            SDL_WaitCondition(has_space, lock);
+        stats.blocked_ns += SDL_GetTicksNS() - start;
+    }
+    SDL_UnlockMutex(lock);
+
+    /* The slot at head is not visible to the writer until queued. */
+    capture_chunk written = slots[head];
+    slots[head] = filling[stream];
+    filling[stream] = (capture_chunk){ written.data, 0, stream };
+    head = (head + 1) % NUM_CHUNKS;
+
+    SDL_LockMutex(lock);
+    queued++;
+    SDL_SignalCondition(has_chunks);
+    SDL_UnlockMutex(lock);
+}
+
+bool audio_capture_stop(void)
+{
+    if (!started)
+        return true;
+    started = false;
+
+    for (int i = 0; i < num_streams; i++) {
+        if (filling[i].len > 0)
+            queue_chunk(i);
+    }
+    SDL_LockMutex(lock);
+    stopping = true;
+    SDL_SignalCondition(has_chunks);
+    SDL_UnlockMutex(lock);
+    SDL_WaitThread(writer, NULL);
+    writer = NULL;
+
+    for (int i = 0; i < num_streams && args.format == CAPTURE_FORMAT_WAV; i++) {
+        FILE *file = streams[i].file;
+        if (write_failed || file == stdout)
+            break;
+        byte header[WAV_HEADER_LEN];
+        make_wav_header(header, (uint32_t)SDL_min(streams[i].data_bytes,
+            UINT32_MAX - WAV_HEADER_LEN));
+        if (fseek(file, 0, SEEK_SET) != 0 ||
+            fwrite(header, 1, sizeof(header), file) != sizeof(header)) {
+            SDL_Log("Could not complete the header of %s", streams[i].path);
+            write_failed = true;
+        }
+    }
+    close_streams();
+    free_chunks();
+    return !write_failed;
+}
+
+/* Appends the samples to the stream's chunk as little-endian, queuing it
+   whenever it fills up. */
+static void append(int stream, const int16_t *samples, int frames)
+{
+    size_t left = (size_t)frames * 2;
+    while (left > 0) {
+        capture_chunk *c = &filling[stream];
+        if (c->len == CHUNK_BYTES) {
+            queue_chunk(stream);
+            continue;
+        }
+        size_t n = SDL_min(left, (CHUNK_BYTES - c->len) / 2);
+        byte *dst = c->data + c->len;
+        for (size_t i = 0; i < n; i++)
+            put_le16(dst + i * 2, (uint16_t)samples[i]);
+        c->len += n * 2;
+        samples += n;
+        left -= n;
+    }
+}
+
+void audio_capture_push_mix(const int16_t *samples, int frames)
+{
+    append(0, samples, frames);
+    SDL_LockMutex(lock);
+    stats.frames += frames;
+    SDL_UnlockMutex(lock);
+}
+
+void audio_capture_push_channel(int channel, const int16_t *samples,
+    int frames)
+{
+    if (1 + channel < num_streams)
+        append(1 + channel, samples, frames);
+}
+
+audio_capture_stats audio_capture_get_stats(void)
+{
+    if (!started)
+        return stats;
+    SDL_LockMutex(lock);
+    audio_capture_stats copy = stats;
+    SDL_UnlockMutex(lock);
+    return copy;
+}
+
+/* Writer thread */
+
+static int loop_writer(void *_)
+{
+    while (true) {
+        SDL_LockMutex(lock);
+        while (queued == 0 && !stopping)
+            SDL_WaitCondition(has_chunks, lock);
+        int n = queued;
+        bool done = stopping && n == 0;
+        SDL_UnlockMutex(lock);
+        if (done)
+            break;
+
+        /* The slots taken stay owned by this thread until released. */
+        uint64_t bytes = 0;
+        int writes = 0;
+        for (int i = 0; i < n; i++) {
+            const capture_chunk *c = &slots[(tail + i) % NUM_CHUNKS];
+            capture_stream *s = &streams[c->stream];
+            if (write_failed)
+                break;
+            if (fwrite(c->data, 1, c->len, s->file) != c->len) {
+                SDL_Log("Audio capture stopped: could not write to %s", s->path);
+                write_failed = true;
+                break;
+            }
+            s->data_bytes += c->len;
+            bytes += c->len;
+            writes++;
+        }
+
+        SDL_LockMutex(lock);
+        tail = (tail + n) % NUM_CHUNKS;
+        queued -= n;
+        stats.bytes += bytes;
+        stats.writes += writes;
+        SDL_SignalCondition(has_space);
+        SDL_UnlockMutex(lock);
+    }
+    return 0;
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Captures sound to WAV or raw PCM files: the mixed output and, optionally,
+   each channel on its own ("stems"). Samples are appended to a chunk per
+   file, and full chunks are queued for a writer thread that writes them out
+   in order. The producer waits for a free chunk rather than dropping
+   samples, so the files only depend on what was emulated. */
+
+#define CAPTURE_NUM_STEMS 4
+
+typedef enum {
+    CAPTURE_FORMAT_WAV,
+    CAPTURE_FORMAT_RAW  /* Interleaved stereo, signed 16-bit little-endian. */
+} capture_format;
+
+typedef struct {
+    /* "-" for standard output, without stems. WAV headers written to
+       standard output give no length. */
+    const char *path;
+    capture_format format;
+    int rate;
+    /* Also write each channel to PATH with -square1, -square2, -wave or
+       -noise before the extension. */
+    bool stems;
+} audio_capture_args;
+
+typedef struct {
+    uint64_t frames;     /* Of the mix. */
+    uint64_t bytes;      /* Written, to all files. */
+    uint64_t writes;
+    uint64_t blocked_ns; /* Spent by the producer waiting for the writer. */
+} audio_capture_stats;
+
+/* From the name used on the command line. */
+bool audio_capture_parse_format(const char *name, capture_format *format);
+
+bool audio_capture_start(audio_capture_args args);
+/* Writes out the queued samples and completes the WAV headers. Returns
+   false if any write failed. */
+bool audio_capture_stop(void);
+/* Called on the emulation thread with interleaved stereo samples. */
+void audio_capture_push_mix(const int16_t *samples, int frames);
+void audio_capture_push_channel(int channel, const int16_t *samples,
+    int frames);
+audio_capture_stats audio_capture_get_stats(void);
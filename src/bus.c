@@ -7,6 +7,7 @@
 #include "interrupt.h"
 #include "input.h"
 #include "dma.h"
+#include "apu.h"
 
 #include <stdio.h>
 
@@ -20,12 +21,29 @@ typedef enum {
 } bus_type;
 static bus_type dma_read_bus;
 static byte dma_read_val;
+static const cart_map *cart;
 
 /* TODO: Refactor IO using array of register descriptors (?) */
 static byte io_read(uint16_t addr);
 static void io_write(uint16_t addr, byte val);
 static inline uint16_t map_echo_to_wram(uint16_t addr);
 
+bool bus_init(void)
+{
+    cart = cart_get_map();
+    return true;
+}
+
+/* Through the mapper's bank pointers, where it has them. */
+static inline byte read_cart(uint16_t addr)
+{
+    if (addr < VRAM_START)
+        return cart->rom[addr >> 14][addr & 0x3FFF];
+    if (cart->ram != NULL)
+        return cart->ram[addr & 0x1FFF];
+    return cart_read(addr);
+}
+
 /* For the CPU - (Attempt to) read memory at addr. */
 byte bus_read_cpu(uint16_t addr)
 {
@@ -43,7 +61,7 @@ byte bus_read_cpu(uint16_t addr)
                 dma_conflict = true;
                 break;
             }
-            val = cart_read(addr);
+            val = read_cart(addr);
             break;
         case VRAM:
             if (dma_is_active() && dma_read_bus == VRAM_BUS) {
@@ -113,7 +131,10 @@ void bus_write_cpu(uint16_t addr, byte val)
                 dma_conflict = true;
                 break;
             }
-            cart_write(addr, val);
+            if (region == EXT_RAM && cart->ram != NULL)
+                cart->ram[addr & 0x1FFF] = val;
+            else
+                cart_write(addr, val);
             break;
         case VRAM:
             if (mode == MODE3_DRAW) {
@@ -185,17 +206,38 @@ byte bus_read_ppu(uint16_t addr)
 #ifdef DEBUG
         //printf("DMA conflict for PPU memory read!\n");
 #endif
-        val = region == OAM ? 0xFF : dma_read_bus;
+        val = region == OAM ? 0xFF : dma_read_val;
     }
 
     return val;
 }
 
+/* For debugging and state dumps - Read memory at addr, ignoring PPU and DMA
+   conflicts. */
+byte bus_peek(uint16_t addr)
+{
+    switch (get_addr_region(addr)) {
+        case BANK0:
+        case BANK1:
+        case EXT_RAM: return read_cart(addr);
+        case VRAM:    return vram_read(addr);
+        case ECHO:    return wram_read(map_echo_to_wram(addr));
+        case WRAM:    return wram_read(addr);
+        case OAM:     return oam_read(addr);
+        case IO_REGS: return io_read(addr);
+        case HRAM:    return hram_read(addr);
+        default:      return 0xFF;
+    }
+}
+
+void bus_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, dma_read_bus);
+    SNAPSHOT(s, dma_read_val);
+}
+
 void bus_copy_dma(uint16_t src, uint16_t dst)
 {
-    /* Reads beyond external RAM are invalid and lead to undefined behavior.
-       Here, we just transfer 0xFF. */
-       
     region_type src_region = get_addr_region(src);
     byte val = 0xFF;
     dma_read_bus = BUS_NOT_DEFINED;
@@ -205,7 +247,7 @@ void bus_copy_dma(uint16_t src, uint16_t dst)
         case BANK1:
         case EXT_RAM:
             dma_read_bus = EXT_BUS;
-            val = cart_read(src);
+            val = read_cart(src);
             break;
         case VRAM:
             dma_read_bus = VRAM_BUS;
@@ -214,15 +256,19 @@ void bus_copy_dma(uint16_t src, uint16_t dst)
         case WRAM:
             val = wram_read(src);
             break;
-#ifdef DEBUG
         default:
-            //printf("DMA read source in undefined region\n");
+            /* On DMG, DMA sees WRAM all the way up to 0xFFFF. */
+            val = wram_read(src - 0x2000);
             break;
-#endif
     }
 
     dma_read_val = val;
-    oam_write(dst, val);
+    oam_dma_write(dst, val);
+}
+
+/* Whether PPU reads from VRAM currently see the DMA transfer instead. */
+bool bus_dma_blocks_vram(void) {
+    return dma_is_active() && dma_read_bus == VRAM_BUS;
 }
 
 region_type get_addr_region(uint16_t addr) {
@@ -275,7 +321,10 @@ static byte io_read(uint16_t addr)
         case WX_REG:   return ppu_wx_read();
         /* ... */
         case IE_REG:   return int_ie_read();
-        default: return 0xFF;
+        default:
+            if (addr >= NR10_REG && addr <= WAVE_RAM_END)
+                return apu_read(addr);
+            return 0xFF;
     }
 }
 
@@ -304,6 +353,10 @@ static void io_write(uint16_t addr, byte val)
         case WX_REG:   ppu_wx_write(val);       break;
         /* ... */
         case IE_REG:   int_ie_write(val); break;
+        default:
+            if (addr >= NR10_REG && addr <= WAVE_RAM_END)
+                apu_write(addr, val);
+            break;
     }
 }
 
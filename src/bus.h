@@ -1,6 +1,8 @@
 #pragma once
 #include "byte.h"
+#include "snapshot.h"
 #include <stdint.h>
+#include <stdbool.h>
 
 #define BANK0_START   0x0000
 #define BANK0_SIZE           0x4000
@@ -48,6 +50,30 @@ typedef enum {
 
 #define IF_REG   0xFF0F
 
+#define NR10_REG 0xFF10
+#define NR11_REG 0xFF11
+#define NR12_REG 0xFF12
+#define NR13_REG 0xFF13
+#define NR14_REG 0xFF14
+#define NR21_REG 0xFF16
+#define NR22_REG 0xFF17
+#define NR23_REG 0xFF18
+#define NR24_REG 0xFF19
+#define NR30_REG 0xFF1A
+#define NR31_REG 0xFF1B
+#define NR32_REG 0xFF1C
+#define NR33_REG 0xFF1D
+#define NR34_REG 0xFF1E
+#define NR41_REG 0xFF20
+#define NR42_REG 0xFF21
+#define NR43_REG 0xFF22
+#define NR44_REG 0xFF23
+#define NR50_REG 0xFF24
+#define NR51_REG 0xFF25
+#define NR52_REG 0xFF26
+#define WAVE_RAM_START 0xFF30
+#define WAVE_RAM_END   0xFF3F
+
 /* ... */
 
 #define LCDC_REG 0xFF40
@@ -67,11 +93,16 @@ typedef enum {
 
 #define IE_REG   0xFFFF
 
+/* After cart_init. */
+bool bus_init(void);
 byte bus_read_cpu(uint16_t addr);
 void bus_write_cpu(uint16_t addr, byte val);
 
 byte bus_read_ppu(uint16_t addr);
+byte bus_peek(uint16_t addr);
 
 void bus_copy_dma(uint16_t src, uint16_t dst);
+void bus_snapshot(snapshot *s);
+bool bus_dma_blocks_vram(void);
 
 region_type get_addr_region(uint16_t addr);
\ No newline at end of file
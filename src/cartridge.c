@@ -1,5 +1,7 @@
 #include "cartridge.h"
 #include "bus.h"
+#include "timer.h"
+#include "system.h"
 #include <SDL3/SDL.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -13,12 +15,23 @@ typedef enum {
     MBC1_RAM         = 0x02,
     MBC1_RAM_BATTERY = 0x03,
     /* ... */
+    MBC2         = 0x05,
+    MBC2_BATTERY = 0x06,
+    /* ... */
     MBC3_TIMER_BATTERY     = 0x0F,
     MBC3_TIMER_RAM_BATTERY = 0x10,
     MBC3                   = 0x11,
     MBC3_RAM               = 0x12,
     MBC3_RAM_BATTERY       = 0x13,
     /* ... */
+    MBC5                     = 0x19,
+    MBC5_RAM                 = 0x1A,
+    MBC5_RAM_BATTERY         = 0x1B,
+    MBC5_RUMBLE              = 0x1C,
+    MBC5_RUMBLE_RAM          = 0x1D,
+    MBC5_RUMBLE_RAM_BATTERY  = 0x1E,
+    /* ... */
+    HUC1_RAM_BATTERY = 0xFF
 } cart_type;
 static cart_type type;
 
@@ -29,36 +42,46 @@ static unsigned int rom_banks_16kib;
 static byte *cart_ram;
 static size_t cart_ram_size;
 static unsigned int ram_banks_8kib;
-static bool has_ram, has_ram_battery, has_rtc;
-
-static byte (*read_fn)(uint16_t);
-static void (*write_fn)(uint16_t, byte);
-
-/* */
-
-static byte mbc0_read(uint16_t addr);
-static void mbc0_write(uint16_t addr, byte val);
-
-static void mbc1_init(void);
-static byte mbc1_read(uint16_t addr);
-static void mbc1_write(uint16_t addr, byte val);
+static bool has_ram, has_battery, has_rtc;
 
+/* Everything that differs between memory bank controllers. Each one's
+   descriptor follows its functions below. */
 typedef struct {
-    byte secs;
-    byte mins;
-    byte hours;
-    byte day_lo; byte day_hi;
-} rtc_regs;
-static rtc_regs mbc3_rtc_regs;
-static void mbc3_init(void);
-static byte mbc3_read(uint16_t addr);
-static void mbc3_write(uint16_t addr, byte val);
+    const char *name;
+    /* RAM in the controller itself, in bytes. The header then gives none. */
+    size_t builtin_ram_size;
+    void (*init)(void);
+    /* Recomputes map from the mapper's registers. */
+    void (*remap)(void);
+    /* External RAM reads while map.ram is NULL. */
+    byte (*read)(uint16_t addr);
+    /* Writes to mapper registers, and external RAM while map.ram is NULL. */
+    void (*write)(uint16_t addr, byte val);
+    /* The mapper's registers. NULL if it has none. */
+    void (*snapshot)(snapshot *s);
+    /* Battery-backed state, from and to the save files. */
+    void (*load)(void);
+    void (*save)(void);
+} mapper;
+
+static const mapper mbc0_mapper;
+static const mapper mbc1_mapper;
+static const mapper mbc1m_mapper;
+static const mapper mbc2_mapper;
+static const mapper mbc3_mapper;
+static const mapper mbc5_mapper;
+static const mapper huc1_mapper;
+
+static const mapper *mbc;
+static cart_map map;
 
 static char *sav_path;
 static char *rtc_path;
+static bool persist;
 
-bool cart_init(const char *rom_path)
+bool cart_init(const char *rom_path, bool _persist)
 {
+    persist = _persist;
     cart_rom = SDL_LoadFile(rom_path, &cart_rom_size);
     if (cart_rom == NULL) {
         SDL_SetError("Failed to read the provided game file");
@@ -76,34 +99,46 @@ bool cart_init(const char *rom_path)
     
     /* Read MBC from cartridge header. */
     type = cart_rom[0x147];
-    has_ram = false; has_ram_battery = false; has_rtc = false;
+    has_ram = false; has_battery = false; has_rtc = false;
     switch (type) {
         case ROM_ONLY:
-            SDL_Log("No MBC");
-            read_fn = &mbc0_read;
-            write_fn = &mbc0_write;
+            mbc = &mbc0_mapper;
             break;
         
-        case MBC1_RAM_BATTERY: has_ram_battery = true;
+        case MBC1_RAM_BATTERY: has_battery = true;
         case MBC1_RAM: has_ram = true;
         case MBC1:
-            SDL_Log("MBC1");
-            read_fn = &mbc1_read;
-            write_fn = &mbc1_write;
-            mbc1_init();
+            mbc = &mbc1_mapper;
+            break;
+
+        case MBC2_BATTERY: has_battery = true;
+        case MBC2:
+            has_ram = true;
+            mbc = &mbc2_mapper;
             break;
 
         case MBC3_TIMER_RAM_BATTERY: has_rtc = true;
-        case MBC3_RAM_BATTERY: has_ram_battery = true;
+        case MBC3_RAM_BATTERY: has_battery = true;
         case MBC3_RAM: has_ram = true;
         case MBC3_TIMER_BATTERY: /* has_rtc cannot be set here due to previous fallthroughs. */
         case MBC3:
             if (type == MBC3_TIMER_BATTERY)
-                has_rtc = true;
-            SDL_Log("MBC3");
-            read_fn = &mbc3_read;
-            write_fn = &mbc3_write;
-            mbc3_init();
+                has_rtc = has_battery = true;
+            mbc = &mbc3_mapper;
+            break;
+
+        case MBC5_RAM_BATTERY:
+        case MBC5_RUMBLE_RAM_BATTERY: has_battery = true;
+        case MBC5_RAM:
+        case MBC5_RUMBLE_RAM: has_ram = true;
+        case MBC5:
+        case MBC5_RUMBLE:
+            mbc = &mbc5_mapper;
+            break;
+
+        case HUC1_RAM_BATTERY:
+            has_ram = has_battery = true;
+            mbc = &huc1_mapper;
             break;
 
         default:
@@ -121,6 +156,12 @@ bool cart_init(const char *rom_path)
         SDL_SetError("Header ROM size does not match the provided file");
         return false;
     }
+    /* MBC1M multicarts use the MBC1 types, but wire up one bank bit less.
+       Each game in them starts with its own header. */
+    if (mbc == &mbc1_mapper && rom_banks_16kib == 64 &&
+        memcmp(cart_rom + 0x104, cart_rom + (0x10 << 14) + 0x104, 0x30) == 0)
+        mbc = &mbc1m_mapper;
+    SDL_Log("%s", mbc->name);
 
     byte header_ram = cart_rom[0x149];
     switch (header_ram) {
@@ -133,12 +174,13 @@ bool cart_init(const char *rom_path)
             SDL_SetError("Invalid header RAM size ([0x149] = %02X)", header_ram);
             return false;
     }
-    if (has_ram != (ram_banks_8kib > 0)) {
+    if ((has_ram && mbc->builtin_ram_size == 0) != (ram_banks_8kib > 0)) {
         SDL_SetError("Header is inconsistent");
             return false;
     } 
-    cart_ram_size = ram_banks_8kib * (1 << 13);
-    cart_ram = malloc(cart_ram_size);
+    cart_ram_size = mbc->builtin_ram_size > 0 ? mbc->builtin_ram_size :
+        ram_banks_8kib * (1 << 13);
+    cart_ram = calloc(cart_ram_size, 1);
 
     /* Define save paths. */
     int rom_path_len = strlen(rom_path);
@@ -168,127 +210,150 @@ bool cart_init(const char *rom_path)
     }
 
     SDL_Log("%ld KiB ROM", cart_rom_size / (1 << 10));
-    if (has_ram)
+    if (has_ram && cart_ram_size < (1 << 10))
+        SDL_Log("+ %ld B RAM", cart_ram_size);
+    else if (has_ram)
         SDL_Log("+ %ld KiB RAM", cart_ram_size / (1 << 10));
-    if (has_ram_battery) {
-        SDL_Log("+ Battery");
-        
-        /* Detect .sav file. */
-        size_t sav_data_size;
-        byte *sav_data = SDL_LoadFile(sav_path, &sav_data_size);
-        if (sav_data != NULL) {
-            SDL_Log("Detected .sav file %s", sav_path);
-            if (sav_data_size == cart_ram_size) {
-                memcpy(cart_ram, sav_data, cart_ram_size);
-                SDL_Log("Loaded .sav file");
-            }
-            else {
-                SDL_Log("Invalid .sav file");
-            }
-            SDL_free(sav_data);
-        }
-    }
-    if (has_rtc) {
+    if (has_rtc)
         SDL_Log("+ Real-time clock");
-        
-        /* TODO: Detect .rtc file. */
-    }
 
+    if (mbc->init != NULL)
+        mbc->init();
+    if (has_battery) {
+        SDL_Log("+ Battery");
+        if (persist)
+            mbc->load();
+    }
+    mbc->remap();
     return true;
 }
 
 void cart_deinit()
 {
-    if (has_ram_battery) {
-        /* Write .sav file. */
-        /* TODO: Check success status (?) */
-        SDL_SaveFile(sav_path, cart_ram, cart_ram_size);
-    }
-    if (has_rtc) {
-        /* TODO: Write to .rtc file. */
-        /* TODO: Check success status (?) */
-    }
+    if (has_battery && persist)
+        mbc->save();
 
     SDL_free(cart_rom);
     free(cart_ram);
     free(sav_path);
     free(rtc_path);
+    map = (cart_map){ 0 };
+}
+
+/* Battery-backed RAM is kept in a .sav file. */
+static void load_sav(void)
+{
+    if (cart_ram_size == 0)
+        return;
+
+    /* Detect .sav file. */
+    size_t sav_data_size;
+    byte *sav_data = SDL_LoadFile(sav_path, &sav_data_size);
+    if (sav_data != NULL) {
+        SDL_Log("Detected .sav file %s", sav_path);
+        if (sav_data_size == cart_ram_size) {
+            memcpy(cart_ram, sav_data, cart_ram_size);
+            SDL_Log("Loaded .sav file");
+        }
+        else {
+            SDL_Log("Invalid .sav file");
+        }
+        SDL_free(sav_data);
+    }
+}
+static void save_sav(void)
+{
+    if (cart_ram_size == 0)
+        return;
+
+    /* Write .sav file. */
+    /* TODO: Check success status (?) */
+    SDL_SaveFile(sav_path, cart_ram, cart_ram_size);
+}
+
+const cart_map *cart_get_map(void) {
+    return &map;
+}
+
+byte cart_read(uint16_t addr)
+{
+    if (addr < EXT_RAM_START)
+        return map.rom[addr >> 14][addr & 0x3FFF];
+    if (map.ram != NULL)
+        return map.ram[addr & 0x1FFF];
+    return mbc->read(addr);
+}
+void cart_write(uint16_t addr, byte val)
+{
+    if (addr >= EXT_RAM_START && map.ram != NULL)
+        map.ram[addr & 0x1FFF] = val;
+    else
+        mbc->write(addr, val);
 }
 
-byte cart_read(uint16_t addr) {
-    return read_fn(addr);
+static const byte *rom_bank(unsigned int bank) {
+    return &cart_rom[(size_t)(bank & (rom_banks_16kib - 1)) << 14];
 }
-void cart_write(uint16_t addr, byte val) {
-    write_fn(addr, val);
+static byte *ram_bank(unsigned int bank) {
+    return &cart_ram[(size_t)(bank & (ram_banks_8kib - 1)) << 13];
 }
 
 /* No MBC - 2 ROM banks are directly mapped to memory. */
 /* "Optionally up to 8 KiB of RAM could be connected at $A000-BFFF, using a
    discrete logic decoder in place of a full MBC chip." */
 
+static void mbc0_remap() {
+    map = (cart_map){
+        { cart_rom, cart_rom + BANK1_START }, has_ram ? cart_ram : NULL
+    };
+}
 static byte mbc0_read(uint16_t addr) {
-    region_type region = get_addr_region(addr);
-    if (region == BANK0 || region == BANK1)
-        return cart_rom[addr];
-    if (has_ram && region == EXT_RAM) {
-        return cart_ram[addr - EXT_RAM_START];
-    }
-    
     return 0xFF;
 }
 static void mbc0_write(uint16_t addr, byte val) {
-    region_type region = get_addr_region(addr);
-    if (has_ram && region == EXT_RAM) {
-        cart_ram[addr - EXT_RAM_START] = val;
-    }
     return;
 }
 
-/* MBC1. */
-/* TODO: MBC1M (Multi-cart) (?) */
+static const mapper mbc0_mapper = {
+    "No MBC", 0, NULL, &mbc0_remap, &mbc0_read, &mbc0_write, NULL,
+    &load_sav, &save_sav
+};
+
+/* MBC1, and MBC1M - the same chip, with bank1 wired one bit lower so that
+   it selects a 256 KiB game out of a 1 MiB multicart. */
 
 static bool mbc1_ram_enabled;
 static byte mbc1_bank0_reg;
 static byte mbc1_bank1_reg;
 static bit mbc1_mode;
+/* Of bank0 that select the ROM bank, and the shift of bank1. */
+static int mbc1_bank0_bits;
 
 static void mbc1_init()
 {
+    mbc1_bank0_bits = 5;
     mbc1_ram_enabled = false;
     mbc1_bank0_reg = 0x00;
     mbc1_bank1_reg = 0x00;
     mbc1_mode = 0;
 }
-static uint16_t mbc1_cart_ram_addr(uint16_t addr) {
-    uint8_t bank = mbc1_mode == 1 ? mbc1_bank1_reg : 0x00;
-    bank &= (ram_banks_8kib - 1);
-    uint16_t ram_addr = ((uint16_t)bank << 13) | get_bits(addr, 12, 0);
-    return ram_addr;
-}
-static byte mbc1_read(uint16_t addr)
+static void mbc1_remap()
 {
     byte mbc1_bank0_reg_adj = mbc1_bank0_reg;
     if (mbc1_bank0_reg_adj == 0x00)
         mbc1_bank0_reg_adj = 0x01;
 
-    region_type region = get_addr_region(addr);
-    if (region == BANK0 || region == BANK1) {
-        uint8_t bank = 0x00;
-        if (region == BANK0 && mbc1_mode == 1) {
-            bank = ((uint32_t)mbc1_bank1_reg << 5);
-        }
-        else if (region == BANK1) {
-            bank = ((uint32_t)mbc1_bank1_reg << 5) | mbc1_bank0_reg_adj;
-        }
-        bank &= (rom_banks_16kib - 1);
-        uint32_t rom_addr = ((uint32_t)bank << 14) | get_bits(addr, 13, 0);
-        return cart_rom[rom_addr];
-    }
-    else if (region == EXT_RAM && has_ram && mbc1_ram_enabled) {
-        return cart_ram[mbc1_cart_ram_addr(addr)];
-    }
-    else
-        return 0xFF;
+    /* In mode 1, the upper bits also select the bank at 0x0000-0x3FFF and
+       the RAM bank. */
+    unsigned int upper = mbc1_mode == 1 ? mbc1_bank1_reg : 0x00;
+    unsigned int lower = mbc1_bank0_reg_adj & ((1 << mbc1_bank0_bits) - 1);
+    map.rom[0] = rom_bank(upper << mbc1_bank0_bits);
+    map.rom[1] = rom_bank((mbc1_bank1_reg << mbc1_bank0_bits) | lower);
+    map.ram = has_ram && mbc1_ram_enabled ? ram_bank(upper) : NULL;
+}
+static byte mbc1_read(uint16_t addr) {
+    (void)addr;
+    return 0xFF;
 }
 static void mbc1_write(uint16_t addr, byte val)
 {
@@ -299,12 +364,288 @@ static void mbc1_write(uint16_t addr, byte val)
         case 1: mbc1_bank0_reg   = val & 0x1F; break;
         case 2: mbc1_bank1_reg   = val & 0x03; break;
         case 3: mbc1_mode        = val & 0x01; break;
-        case 5: /* External RAM region */
-            if (has_ram && mbc1_ram_enabled) {
-                cart_ram[mbc1_cart_ram_addr(addr)] = val;
-            }
+        default: /* External RAM, while disabled. */
+            return;
+    }
+    mbc1_remap();
+}
+static void mbc1_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, mbc1_ram_enabled);
+    SNAPSHOT(s, mbc1_bank0_reg);
+    SNAPSHOT(s, mbc1_bank1_reg);
+    SNAPSHOT(s, mbc1_mode);
+}
+static void mbc1m_init()
+{
+    mbc1_init();
+    mbc1_bank0_bits = 4;
+}
+
+static const mapper mbc1_mapper = {
+    "MBC1", 0, &mbc1_init, &mbc1_remap, &mbc1_read, &mbc1_write,
+    &mbc1_snapshot, &load_sav, &save_sav
+};
+static const mapper mbc1m_mapper = {
+    "MBC1M", 0, &mbc1m_init, &mbc1_remap, &mbc1_read, &mbc1_write,
+    &mbc1_snapshot, &load_sav, &save_sav
+};
+
+/* MBC2 - up to 16 ROM banks, and 512 half-bytes of built-in RAM. */
+/* The RAM is repeated over all of 0xA000-0xBFFF and only stores the low
+   half of each byte, so it is always accessed through mbc2_read and
+   mbc2_write. */
+
+#define MBC2_RAM_SIZE 512
+
+static bool mbc2_ram_enabled;
+static byte mbc2_rom_bank_reg;
+
+static void mbc2_init()
+{
+    mbc2_ram_enabled = false;
+    mbc2_rom_bank_reg = 0x01;
+}
+static void mbc2_remap()
+{
+    byte mbc2_rom_bank_reg_adj = mbc2_rom_bank_reg;
+    if (mbc2_rom_bank_reg_adj == 0x00)
+        mbc2_rom_bank_reg_adj = 0x01;
+
+    map.rom[0] = cart_rom;
+    map.rom[1] = rom_bank(mbc2_rom_bank_reg_adj);
+    map.ram = NULL;
+}
+static byte mbc2_read(uint16_t addr)
+{
+    if (!mbc2_ram_enabled)
+        return 0xFF;
+    return cart_ram[addr & (MBC2_RAM_SIZE - 1)] | 0xF0;
+}
+static void mbc2_write(uint16_t addr, byte val)
+{
+    if (addr >= EXT_RAM_START) {
+        if (mbc2_ram_enabled)
+            cart_ram[addr & (MBC2_RAM_SIZE - 1)] = val & 0x0F;
+        return;
+    }
+    if (addr >= BANK1_START)
+        return;
+
+    /* Bit 8 of the address selects the register. */
+    if (get_bit(addr, 8) == 0)
+        mbc2_ram_enabled = ((val & 0x0F) == 0x0A);
+    else {
+        mbc2_rom_bank_reg = val & 0x0F;
+        mbc2_remap();
+    }
+}
+static void mbc2_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, mbc2_ram_enabled);
+    SNAPSHOT(s, mbc2_rom_bank_reg);
+}
+
+static const mapper mbc2_mapper = {
+    "MBC2", MBC2_RAM_SIZE, &mbc2_init, &mbc2_remap, &mbc2_read, &mbc2_write,
+    &mbc2_snapshot, &load_sav, &save_sav
+};
+
+/* MBC3 real-time clock. */
+/* The counters are not ticked: they are brought up to date from the time
+   elapsed since they last were, whenever they are latched, written or
+   saved. While running, that is emulated time, so the clock keeps pace with
+   the game at any speed and goes back with snapshots. While the emulator is
+   closed, it is host time, from the timestamp in the .rtc file. */
+
+#define RTC_HALT  0x40 /* In day_hi */
+#define RTC_CARRY 0x80
+/* Live and latched counters, 4 bytes each, then a 64-bit Unix timestamp,
+   all little-endian. Some emulators write a 32-bit timestamp instead. */
+#define RTC_FILE_SIZE 48
+
+typedef struct {
+    byte secs;
+    byte mins;
+    byte hours;
+    byte day_lo; byte day_hi;
+} rtc_regs;
+static rtc_regs rtc_live;
+static rtc_regs rtc_latched;
+/* Emulated T-cycle rtc_live is as of, less any fraction of a second. */
+static uint64_t rtc_base;
+static byte rtc_latch_reg;
+
+static void rtc_init(void)
+{
+    rtc_live = rtc_latched = (rtc_regs){ 0 };
+    /* Emulated time starts at power on. */
+    rtc_base = 0;
+    rtc_latch_reg = 0xFF;
+}
+
+/* Counts one second. A counter written past its range carries nowhere,
+   and only wraps at its width. */
+static void rtc_tick(rtc_regs *r)
+{
+    if (++r->secs != 60) { r->secs &= 0x3F; return; }
+    r->secs = 0;
+    if (++r->mins != 60) { r->mins &= 0x3F; return; }
+    r->mins = 0;
+    if (++r->hours != 24) { r->hours &= 0x1F; return; }
+    r->hours = 0;
+    if (++r->day_lo != 0)
+        return;
+    /* The day counter has 9 bits. */
+    if (r->day_hi & 0x01)
+        r->day_hi |= RTC_CARRY;
+    r->day_hi ^= 0x01;
+}
+static void rtc_advance(rtc_regs *r, uint64_t secs)
+{
+    while (secs > 0 && (r->secs >= 60 || r->mins >= 60 || r->hours >= 24)) {
+        rtc_tick(r);
+        secs--;
+    }
+    if (secs == 0)
+        return;
+
+    uint64_t time = r->secs + 60 * (r->mins + 60 * (uint64_t)r->hours) + secs;
+    uint64_t days = (r->day_lo | (r->day_hi & 0x01) << 8) + time / 86400;
+    time %= 86400;
+    r->secs = time % 60;
+    r->mins = time / 60 % 60;
+    r->hours = time / 3600;
+    if (days >= 512)
+        r->day_hi |= RTC_CARRY;
+    r->day_lo = days & 0xFF;
+    r->day_hi = (r->day_hi & ~0x01) | ((days >> 8) & 0x01);
+}
+/* Counts the whole seconds emulated since rtc_base, unless halted. */
+static void rtc_update(void)
+{
+    uint64_t now = timer_get_cycles();
+    if (rtc_live.day_hi & RTC_HALT) {
+        rtc_base = now;
+        return;
+    }
+    uint64_t secs = (now - rtc_base) / T_CYCLES_PER_SEC;
+    rtc_advance(&rtc_live, secs);
+    rtc_base += secs * T_CYCLES_PER_SEC;
+}
+
+static byte rtc_read(byte select)
+{
+    switch (select) {
+        case 0x08: return rtc_latched.secs;
+        case 0x09: return rtc_latched.mins;
+        case 0x0A: return rtc_latched.hours;
+        case 0x0B: return rtc_latched.day_lo;
+        case 0x0C: return rtc_latched.day_hi;
+        default:   return 0xFF;
+    }
+}
+static void rtc_write(byte select, byte val)
+{
+    rtc_update();
+    switch (select) {
+        case 0x08:
+            rtc_live.secs = val & 0x3F;
+            /* Also restarts the current second. */
+            rtc_base = timer_get_cycles();
             break;
+        case 0x09: rtc_live.mins   = val & 0x3F; break;
+        case 0x0A: rtc_live.hours  = val & 0x1F; break;
+        case 0x0B: rtc_live.day_lo = val; break;
+        case 0x0C: rtc_live.day_hi = val & (RTC_CARRY | RTC_HALT | 0x01); break;
+    }
+}
+/* Writing 0x00 then 0x01 copies the live counters to the latched ones. */
+static void rtc_latch_write(byte val)
+{
+    if (rtc_latch_reg == 0x00 && val == 0x01) {
+        rtc_update();
+        rtc_latched = rtc_live;
     }
+    rtc_latch_reg = val;
+}
+static void rtc_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, rtc_live);
+    SNAPSHOT(s, rtc_latched);
+    SNAPSHOT(s, rtc_base);
+    SNAPSHOT(s, rtc_latch_reg);
+}
+
+static uint64_t get_le(const byte *src, int len)
+{
+    uint64_t val = 0;
+    for (int i = len - 1; i >= 0; i--)
+        val = (val << 8) | src[i];
+    return val;
+}
+static void put_le(byte *dst, uint64_t val, int len)
+{
+    for (int i = 0; i < len; i++)
+        dst[i] = (byte)(val >> (8 * i));
+}
+static rtc_regs get_rtc_regs(const byte *src)
+{
+    return (rtc_regs){
+        get_le(src, 4) & 0x3F, get_le(src + 4, 4) & 0x3F,
+        get_le(src + 8, 4) & 0x1F, get_le(src + 12, 4),
+        get_le(src + 16, 4) & (RTC_CARRY | RTC_HALT | 0x01)
+    };
+}
+static void put_rtc_regs(byte *dst, const rtc_regs *r)
+{
+    put_le(dst, r->secs, 4);
+    put_le(dst + 4, r->mins, 4);
+    put_le(dst + 8, r->hours, 4);
+    put_le(dst + 12, r->day_lo, 4);
+    put_le(dst + 16, r->day_hi, 4);
+}
+/* Seconds since the Unix epoch, or 0 if unknown. */
+static uint64_t host_time(void)
+{
+    SDL_Time now;
+    if (!SDL_GetCurrentTime(&now) || now < 0)
+        return 0;
+    return (uint64_t)(now / SDL_NS_PER_SECOND);
+}
+
+static void rtc_load(void)
+{
+    /* Detect .rtc file. */
+    size_t rtc_data_size;
+    byte *rtc_data = SDL_LoadFile(rtc_path, &rtc_data_size);
+    if (rtc_data == NULL)
+        return;
+    SDL_Log("Detected .rtc file %s", rtc_path);
+    if (rtc_data_size == RTC_FILE_SIZE || rtc_data_size == RTC_FILE_SIZE - 4) {
+        rtc_live = get_rtc_regs(rtc_data);
+        rtc_latched = get_rtc_regs(rtc_data + 20);
+        uint64_t saved = get_le(rtc_data + 40, (int)rtc_data_size - 40);
+        uint64_t now = host_time();
+        /* The clock kept running while the emulator was closed. */
+        if (saved != 0 && now > saved && !(rtc_live.day_hi & RTC_HALT))
+            rtc_advance(&rtc_live, now - saved);
+        SDL_Log("Loaded .rtc file");
+    }
+    else {
+        SDL_Log("Invalid .rtc file");
+    }
+    SDL_free(rtc_data);
+}
+static void rtc_save(void)
+{
+    byte rtc_data[RTC_FILE_SIZE];
+    rtc_update();
+    put_rtc_regs(rtc_data, &rtc_live);
+    put_rtc_regs(rtc_data + 20, &rtc_latched);
+    put_le(rtc_data + 40, host_time(), 8);
+    if (!SDL_SaveFile(rtc_path, rtc_data, sizeof(rtc_data)))
+        SDL_Log("Could not write .rtc file: %s", SDL_GetError());
 }
 
 /* MBC3. */
@@ -318,43 +659,26 @@ static void mbc3_init()
     mbc3_ram_timer_enabled = false;
     mbc3_rom_bank_reg = 0x00;
     mbc3_ram_timer_select = 0x00;
-
-    /* TODO: Check if RTC registers were already loaded. */
-    mbc3_rtc_regs.secs = 0x00;
-    mbc3_rtc_regs.mins = 0x00;
-    mbc3_rtc_regs.hours = 0x00;
-    mbc3_rtc_regs.day_lo = 0x00; mbc3_rtc_regs.day_hi = 0x00;
+    rtc_init();
 }
-static byte mbc3_read(uint16_t addr)
+static void mbc3_remap()
 {
     byte mbc3_rom_bank_reg_adj = mbc3_rom_bank_reg;
     if (mbc3_rom_bank_reg_adj == 0x00)
         mbc3_rom_bank_reg_adj = 0x01;
 
-    region_type region = get_addr_region(addr);
-    if (region == BANK0) {
-        return cart_rom[addr];
-    }
-    else if (region == BANK1) {
-        uint8_t bank = mbc3_rom_bank_reg_adj & (rom_banks_16kib - 1);
-        uint32_t cart_addr = ((uint32_t)bank << 14) | get_bits(addr, 13, 0);
-        return cart_rom[cart_addr];
-    }
-    else if (region == EXT_RAM && mbc3_ram_timer_enabled) {
-        if (has_ram && mbc3_ram_timer_select < 0x08) {
-            uint8_t bank = mbc3_ram_timer_select & (ram_banks_8kib - 1);
-            uint32_t cart_addr = ((uint32_t)bank << 13) | get_bits(addr, 12, 0);
-            return cart_ram[cart_addr];
-        }
-        else if (has_rtc && mbc3_ram_timer_select >= 0x08) {
-            switch (mbc3_ram_timer_select) {
-                case 0x08: return mbc3_rtc_regs.secs;
-                case 0x09: return mbc3_rtc_regs.mins;
-                case 0x0A: return mbc3_rtc_regs.hours;
-                case 0x0B: return mbc3_rtc_regs.day_lo;
-                case 0x0C: return mbc3_rtc_regs.day_hi;
-            }
-        }
+    map.rom[0] = cart_rom;
+    map.rom[1] = rom_bank(mbc3_rom_bank_reg_adj);
+    /* RTC registers are read through mbc3_read. */
+    map.ram = has_ram && mbc3_ram_timer_enabled && mbc3_ram_timer_select < 0x08 ?
+        ram_bank(mbc3_ram_timer_select) : NULL;
+}
+static byte mbc3_read(uint16_t addr)
+{
+    (void)addr;
+    if (mbc3_ram_timer_enabled) {
+        if (has_rtc && mbc3_ram_timer_select >= 0x08)
+            return rtc_read(mbc3_ram_timer_select);
     }
 
     return 0xFF;
@@ -364,35 +688,174 @@ static void mbc3_write(uint16_t addr, byte val)
     switch (get_bits(addr, 15, 13)) {
         case 0:
             mbc3_ram_timer_enabled = ((val & 0x0F) == 0x0A);
+            mbc3_remap();
             break;
         case 1:
             mbc3_rom_bank_reg = val & 0x7F;
+            mbc3_remap();
             break;
         case 2:
             mbc3_ram_timer_select = val & 0x0F;
+            mbc3_remap();
             break;
         case 3:
-            /* TODO: Latch clock data. */
+            if (has_rtc)
+                rtc_latch_write(val);
             break;
-        case 5: /* External RAM (or RTC register) region */
+        case 5: /* RTC register region, or RAM while disabled */
             if (!mbc3_ram_timer_enabled)
                 return;
 
-            if (has_ram && mbc3_ram_timer_select < 0x08) {
-                uint8_t bank = mbc3_ram_timer_select & (ram_banks_8kib - 1);
-                uint32_t cart_addr = ((uint32_t)bank << 13) | get_bits(addr, 12, 0);
-                cart_ram[cart_addr] = val;
-            }
-            else if (has_rtc && mbc3_ram_timer_select >= 0x08) {
-                /* TODO: Check value validity (?) */
-                switch (mbc3_ram_timer_select) {
-                    case 0x08: mbc3_rtc_regs.secs   = val; break;
-                    case 0x09: mbc3_rtc_regs.mins   = val; break;
-                    case 0x0A: mbc3_rtc_regs.hours  = val; break;
-                    case 0x0B: mbc3_rtc_regs.day_lo = val; break;
-                    case 0x0C: mbc3_rtc_regs.day_hi = val; break;
-                }
-            }
+            if (has_rtc && mbc3_ram_timer_select >= 0x08)
+                rtc_write(mbc3_ram_timer_select, val);
             break;
     }
-}
\ No newline at end of file
+}
+static void mbc3_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, mbc3_ram_timer_enabled);
+    SNAPSHOT(s, mbc3_rom_bank_reg);
+    SNAPSHOT(s, mbc3_ram_timer_select);
+    rtc_snapshot(s);
+}
+static void mbc3_load()
+{
+    load_sav();
+    if (has_rtc)
+        rtc_load();
+}
+static void mbc3_save()
+{
+    save_sav();
+    if (has_rtc)
+        rtc_save();
+}
+
+static const mapper mbc3_mapper = {
+    "MBC3", 0, &mbc3_init, &mbc3_remap, &mbc3_read, &mbc3_write,
+    &mbc3_snapshot, &mbc3_load, &mbc3_save
+};
+
+/* MBC5 - up to 512 ROM banks (8 MiB) and 16 RAM banks (128 KiB). */
+
+static bool mbc5_ram_enabled;
+static uint16_t mbc5_rom_bank_reg;
+static byte mbc5_ram_bank_reg;
+
+static void mbc5_init()
+{
+    mbc5_ram_enabled = false;
+    mbc5_rom_bank_reg = 0x001;
+    mbc5_ram_bank_reg = 0x00;
+}
+static void mbc5_remap()
+{
+    /* Unlike MBC1 and MBC3, bank 0 can be mapped at 0x4000-0x7FFF. */
+    map.rom[0] = cart_rom;
+    map.rom[1] = rom_bank(mbc5_rom_bank_reg);
+    map.ram = has_ram && mbc5_ram_enabled ? ram_bank(mbc5_ram_bank_reg) : NULL;
+}
+static byte mbc5_read(uint16_t addr) {
+    (void)addr;
+    return 0xFF;
+}
+static void mbc5_write(uint16_t addr, byte val)
+{
+    switch (get_bits(addr, 15, 12)) {
+        case 0x0:
+        case 0x1:
+            /* All 8 bits are compared, unlike MBC1 and MBC3. */
+            mbc5_ram_enabled = val == 0x0A;
+            break;
+        case 0x2:
+            mbc5_rom_bank_reg = set_lo_byte(mbc5_rom_bank_reg, val);
+            break;
+        case 0x3:
+            mbc5_rom_bank_reg = overlay_masked(mbc5_rom_bank_reg,
+                (uint16_t)(val & 0x01) << 8, 0x100);
+            break;
+        case 0x4:
+        case 0x5:
+            /* On rumble carts, bit 3 drives the motor instead. */
+            mbc5_ram_bank_reg = val & (type >= MBC5_RUMBLE ? 0x07 : 0x0F);
+            break;
+        default: /* 0x6000-0x7FFF is unused, as is external RAM while disabled. */
+            return;
+    }
+    mbc5_remap();
+}
+static void mbc5_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, mbc5_ram_enabled);
+    SNAPSHOT(s, mbc5_rom_bank_reg);
+    SNAPSHOT(s, mbc5_ram_bank_reg);
+}
+
+static const mapper mbc5_mapper = {
+    "MBC5", 0, &mbc5_init, &mbc5_remap, &mbc5_read, &mbc5_write,
+    &mbc5_snapshot, &load_sav, &save_sav
+};
+
+/* HuC1 - up to 64 ROM banks and 4 RAM banks, with an infrared port mapped
+   over the RAM instead of a RAM enable. */
+/* Infrared is not emulated: the receiver never sees light, and the LED
+   is ignored. */
+
+static bool huc1_ir_selected;
+static byte huc1_rom_bank_reg;
+static byte huc1_ram_bank_reg;
+
+static void huc1_init()
+{
+    huc1_ir_selected = false;
+    huc1_rom_bank_reg = 0x01;
+    huc1_ram_bank_reg = 0x00;
+}
+static void huc1_remap()
+{
+    byte huc1_rom_bank_reg_adj = huc1_rom_bank_reg;
+    if (huc1_rom_bank_reg_adj == 0x00)
+        huc1_rom_bank_reg_adj = 0x01;
+
+    map.rom[0] = cart_rom;
+    map.rom[1] = rom_bank(huc1_rom_bank_reg_adj);
+    map.ram = huc1_ir_selected ? NULL : ram_bank(huc1_ram_bank_reg);
+}
+static byte huc1_read(uint16_t addr) {
+    (void)addr;
+    return 0xC0; /* No light */
+}
+static void huc1_write(uint16_t addr, byte val)
+{
+    switch (get_bits(addr, 15, 13)) {
+        case 0: huc1_ir_selected  = val == 0x0E; break;
+        case 1: huc1_rom_bank_reg = val & 0x3F; break;
+        case 2: huc1_ram_bank_reg = val & 0x03; break;
+        default: /* 0x6000-0x7FFF is unused, and the LED is ignored. */
+            return;
+    }
+    huc1_remap();
+}
+static void huc1_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, huc1_ir_selected);
+    SNAPSHOT(s, huc1_rom_bank_reg);
+    SNAPSHOT(s, huc1_ram_bank_reg);
+}
+
+static const mapper huc1_mapper = {
+    "HuC1", 0, &huc1_init, &huc1_remap, &huc1_read, &huc1_write,
+    &huc1_snapshot, &load_sav, &save_sav
+};
+
+/* */
+
+void cart_snapshot(snapshot *s)
+{
+    if (has_ram)
+        snapshot_field(s, cart_ram, cart_ram_size);
+    if (mbc->snapshot != NULL)
+        mbc->snapshot(s);
+    if (s->pass == SNAPSHOT_LOAD)
+        mbc->remap();
+}
@@ -1,11 +1,26 @@
 #pragma once
 #include "byte.h"
+#include "snapshot.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <string.h>
 
-bool cart_init(const char *rom_path);
+/* Where cartridge accesses go, recomputed by the mapper whenever a bank or
+   mode register is written, so that they take no address arithmetic. ram is
+   NULL while external RAM accesses do not go to RAM (disabled, absent, or
+   mapped to other registers) -- they then go through cart_read and
+   cart_write. */
+typedef struct {
+    const byte *rom[2]; /* 0x0000-0x3FFF and 0x4000-0x7FFF */
+    byte *ram;          /* 0xA000-0xBFFF */
+} cart_map;
+
+/* Without persist, battery-backed state starts blank and is not saved. */
+bool cart_init(const char *rom_path, bool persist);
 void cart_deinit(void);
+void cart_snapshot(snapshot *s);
 
+/* Stays valid until cart_deinit. */
+const cart_map *cart_get_map(void);
 byte cart_read(uint16_t addr);
 void cart_write(uint16_t addr, byte val);
\ No newline at end of file
@@ -159,9 +159,16 @@ void cpu_tick(void)
 }
 
 #ifndef SM83
+cpu_state cpu_get_state() {
+    return state;
+}
+
 byte hram_read(uint16_t addr) {
     return hram[addr - HRAM_START];
 }
+const byte *cpu_get_hram(void) {
+    return hram;
+}
 void hram_write(uint16_t addr, byte val) {
     hram[addr - HRAM_START] = val;
 }
@@ -2288,4 +2295,22 @@ void sm83_set_state(cpu_state _state)
     halted = false;
     fetch_and_decode();
 }
-#endif
\ No newline at end of file
+#endif
+#ifndef SM83
+void cpu_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, hram);
+    SNAPSHOT(s, state);
+    SNAPSHOT(s, wz_latch);
+    SNAPSHOT(s, instr_reg);
+    SNAPSHOT(s, instr_func);
+    SNAPSHOT(s, instr_cycle);
+    SNAPSHOT(s, instr_complete);
+    SNAPSHOT(s, cb_prefixed);
+    SNAPSHOT(s, cond);
+    SNAPSHOT(s, adj);
+    SNAPSHOT(s, set_ime);
+    SNAPSHOT(s, halted);
+    SNAPSHOT(s, jump_vec);
+}
+#endif
@@ -1,5 +1,6 @@
 #pragma once
 #include "byte.h"
+#include "snapshot.h"
 #include <stdint.h>
 #include <stdbool.h>
 
@@ -25,7 +26,11 @@ bool cpu_init(void);
 void cpu_tick(void);
 
 #ifndef CPU_TEST
+cpu_state cpu_get_state(void);
+void cpu_snapshot(snapshot *s);
+
 byte hram_read(uint16_t addr);
+const byte *cpu_get_hram(void);
 void hram_write(uint16_t addr, byte val);
 #endif
 
@@ -39,6 +39,15 @@ void dma_tick()
     base++;
 }
 
+void dma_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, dma_reg);
+    SNAPSHOT(s, dma_latched);
+    SNAPSHOT(s, base);
+    SNAPSHOT(s, start);
+    SNAPSHOT(s, active);
+}
+
 bool dma_is_active() {
     return active;
 }
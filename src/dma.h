@@ -1,9 +1,11 @@
 #include "byte.h"
+#include "snapshot.h"
 #include <stdint.h>
 #include <stdbool.h>
 
 bool dma_init(void);
 void dma_tick(void);
+void dma_snapshot(snapshot *s);
 
 bool dma_is_active(void);
 
@@ -0,0 +1,278 @@
+#include <SDL3/SDL.h>
+#include "system.h"
+#include "recorder.h"
+#include "shm_export.h"
+#include "audio_capture.h"
+#include "apu.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Runs a ROM without a window as fast as possible, then dumps the requested
+   state. SDL is only used for its file, time and thread functions -- video is
+   never initialized. */
+
+#define MAX_RAM_DUMPS 16
+typedef struct {
+    uint16_t start;
+    uint32_t len;
+    const char *path;
+} ram_dump;
+
+static const char *rom_path;
+static uint64_t frames = 60;
+/* M-cycles; overrides frames when set. */
+static uint64_t cycles;
+static const char *frame_path;
+static ram_dump ram_dumps[MAX_RAM_DUMPS];
+static int num_ram_dumps;
+static bool print_hash = false;
+/* Off by default, so that runs do not depend on earlier ones or the time of
+   day, and sessions of the same ROM can run side by side. */
+static bool persist = false;
+static bool sys_ready = false;
+/* Nothing is waiting on the frames here, so the recorder blocks by default. */
+static recorder_args rec_args = {
+    .format = REC_FORMAT_Y4M, .policy = REC_BLOCK, .buffers = 16
+};
+static bool recording = false;
+static const char *export_name;
+static bool exporting = false;
+static audio_capture_args capture_args = {
+    .format = CAPTURE_FORMAT_WAV, .rate = APU_DEFAULT_RATE
+};
+static bool capturing = false;
+
+/* ADDR:LEN:PATH, with ADDR and LEN in hex. */
+static bool parse_ram_dump(char *arg)
+{
+    char *len_str = strchr(arg, ':');
+    char *path = len_str != NULL ? strchr(len_str + 1, ':') : NULL;
+    if (path == NULL || num_ram_dumps == MAX_RAM_DUMPS) {
+        SDL_SetError("Invalid RAM dump %s", arg);
+        return false;
+    }
+
+    unsigned long start = strtoul(arg, NULL, 16);
+    unsigned long len = strtoul(len_str + 1, NULL, 16);
+    if (start > 0xFFFF || len == 0 || start + len > 0x10000) {
+        SDL_SetError("RAM dump %s is out of range", arg);
+        return false;
+    }
+
+    ram_dumps[num_ram_dumps++] = (ram_dump){
+        (uint16_t)start, (uint32_t)len, path + 1
+    };
+    return true;
+}
+
+/* Binary PPM, from the RGBA8888 frame. */
+static bool write_frame(const char *path)
+{
+    const uint32_t *frame = sys_acquire_frame(NULL);
+    int pitch = sys_get_frame_pitch() / (int)sizeof(uint32_t);
+
+    SDL_IOStream *io = SDL_IOFromFile(path, "wb");
+    if (io == NULL)
+        return false;
+    char header[32];
+    int header_len = snprintf(header, sizeof(header), "P6\n%d %d\n255\n",
+        GB_WIDTH, GB_HEIGHT);
+    bool ok = SDL_WriteIO(io, header, header_len) == (size_t)header_len;
+    for (int y = 0; ok && y < GB_HEIGHT; y++) {
+        byte row[GB_WIDTH * 3];
+        for (int x = 0; x < GB_WIDTH; x++) {
+            uint32_t px = frame[y * pitch + x];
+            row[x * 3 + 0] = (px >> 24) & 0xFF;
+            row[x * 3 + 1] = (px >> 16) & 0xFF;
+            row[x * 3 + 2] = (px >>  8) & 0xFF;
+        }
+        ok = SDL_WriteIO(io, row, sizeof(row)) == sizeof(row);
+    }
+    return SDL_CloseIO(io) && ok;
+}
+
+static bool write_ram(const ram_dump *dump)
+{
+    byte *data = SDL_malloc(dump->len);
+    if (data == NULL)
+        return false;
+    for (uint32_t i = 0; i < dump->len; i++)
+        data[i] = sys_peek((uint16_t)(dump->start + i));
+    bool ok = SDL_SaveFile(dump->path, data, dump->len);
+    SDL_free(data);
+    return ok;
+}
+
+static void on_frame_tap(const void *frame)
+{
+    if (recording)
+        recorder_push_frame(frame);
+    if (exporting)
+        shm_export_publish(frame);
+}
+
+int main(int argc, char *argv[])
+{
+    /* Usage: mydmg-headless [--frames N | --cycles N] [--dump-frame PATH]
+                            [--dump-ram ADDR:LEN:PATH]... [--hash]
+                            [--record PATH] [--record-format y4m|raw]
+                            [--record-policy block|drop]
+                            [--record-buffers N] [--export-shm NAME]
+                            [--record-audio PATH]
+                            [--record-audio-format wav|raw]
+                            [--record-stems] [--audio-rate N]
+                            [--persist] ROM path */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc)
+            frames = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc)
+            cycles = strtoull(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "--dump-frame") == 0 && i + 1 < argc)
+            frame_path = argv[++i];
+        else if (strcmp(argv[i], "--dump-ram") == 0 && i + 1 < argc) {
+            if (!parse_ram_dump(argv[++i])) goto failure;
+        }
+        else if (strcmp(argv[i], "--hash") == 0)
+            print_hash = true;
+        else if (strcmp(argv[i], "--persist") == 0)
+            persist = true;
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            rec_args.path = argv[++i];
+        else if (strcmp(argv[i], "--record-format") == 0 && i + 1 < argc) {
+            if (!recorder_parse_format(argv[++i], &rec_args.format)) goto failure;
+        }
+        else if (strcmp(argv[i], "--record-policy") == 0 && i + 1 < argc) {
+            if (!recorder_parse_policy(argv[++i], &rec_args.policy)) goto failure;
+        }
+        else if (strcmp(argv[i], "--record-buffers") == 0 && i + 1 < argc)
+            rec_args.buffers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--export-shm") == 0 && i + 1 < argc)
+            export_name = argv[++i];
+        else if (strcmp(argv[i], "--record-audio") == 0 && i + 1 < argc)
+            capture_args.path = argv[++i];
+        else if (strcmp(argv[i], "--record-audio-format") == 0 && i + 1 < argc) {
+            if (!audio_capture_parse_format(argv[++i], &capture_args.format))
+                goto failure;
+        }
+        else if (strcmp(argv[i], "--record-stems") == 0)
+            capture_args.stems = true;
+        else if (strcmp(argv[i], "--audio-rate") == 0 && i + 1 < argc) {
+            i++;
+            capture_args.rate = SDL_clamp(atoi(argv[i]), 8000, 192000);
+        }
+        else if (rom_path == NULL)
+            rom_path = argv[i];
+    }
+    if (rom_path == NULL) {
+        SDL_SetError("No ROM path given");
+        goto failure;
+    }
+
+    system_args sys_args = (system_args){
+        rom_path, PPU_FORMAT_RGBA8888, false, false, capture_args.rate,
+        persist
+    };
+    /* Pixels are generated on this thread -- sessions are meant to be run
+       side by side, one per core. */
+    if (!sys_init(sys_args))
+        goto failure;
+    sys_ready = true;
+    if (rec_args.path != NULL) {
+        rec_args.frame_format = PPU_FORMAT_RGBA8888;
+        if (!recorder_start(rec_args))
+            goto failure;
+        recording = true;
+    }
+    if (export_name != NULL) {
+        if (!shm_export_start(export_name, PPU_FORMAT_RGBA8888))
+            goto failure;
+        exporting = true;
+    }
+    if (recording || exporting)
+        sys_set_frame_tap(&on_frame_tap);
+    if (capture_args.path != NULL) {
+        if (!audio_capture_start(capture_args))
+            goto failure;
+        capturing = true;
+        sys_set_audio_sink(&audio_capture_push_mix);
+        if (capture_args.stems &&
+            !sys_set_channel_sink(&audio_capture_push_channel)) {
+            SDL_SetError("Could not allocate the stem buffers");
+            goto failure;
+        }
+    }
+
+    if (cycles == 0)
+        cycles = frames * M_CYCLES_PER_FRAME;
+    Uint64 start = SDL_GetTicksNS();
+    for (uint64_t i = 0; i < cycles; i++)
+        sys_tick();
+    Uint64 elapsed = SDL_GetTicksNS() - start;
+
+    double secs = (double)elapsed / 1e9;
+    SDL_Log("%llu M-cycles in %.3f s (%.2f MHz, %.1f frames/s)",
+        (unsigned long long)cycles, secs,
+        (double)cycles * T_M_RATIO / secs / 1e6,
+        (double)cycles / M_CYCLES_PER_FRAME / secs);
+    apu_stats apu = sys_get_apu_stats();
+    SDL_Log("APU idle for %.1f%% of the sound",
+        apu.flushes > 0 ? 100.0 * apu.idle_flushes / apu.flushes : 0.0);
+    if (recording) {
+        recorder_stop();
+        recording = false;
+        recorder_stats rec = recorder_get_stats();
+        SDL_Log("Recorded %llu frames (%llu dropped) in %llu writes of %.1f MiB; "
+            "blocked for %.1f ms",
+            (unsigned long long)rec.frames, (unsigned long long)rec.dropped,
+            (unsigned long long)rec.writes, rec.bytes / 1048576.0,
+            rec.blocked_ns / 1e6);
+    }
+    if (exporting) {
+        shm_export_stop();
+        exporting = false;
+    }
+    if (capturing) {
+        sys_flush_audio();
+        sys_set_audio_sink(NULL);
+        sys_set_channel_sink(NULL);
+        capturing = false;
+        if (!audio_capture_stop()) {
+            SDL_SetError("Could not write %s", capture_args.path);
+            goto failure;
+        }
+        audio_capture_stats cap = audio_capture_get_stats();
+        SDL_Log("Captured %llu audio frames in %llu writes of %.1f MiB; "
+            "blocked for %.1f ms",
+            (unsigned long long)cap.frames, (unsigned long long)cap.writes,
+            cap.bytes / 1048576.0, cap.blocked_ns / 1e6);
+    }
+
+    if (frame_path != NULL && !write_frame(frame_path))
+        goto failure;
+    for (int i = 0; i < num_ram_dumps; i++) {
+        if (!write_ram(&ram_dumps[i]))
+            goto failure;
+    }
+    if (print_hash)
+        printf("%016llx\n", (unsigned long long)sys_state_hash());
+
+    sys_deinit();
+    SDL_Quit();
+    return 0;
+failure:
+    SDL_Log("Error: %s", SDL_GetError());
+    if (recording)
+        recorder_stop();
+    if (exporting)
+        shm_export_stop();
+    if (capturing) {
+        sys_set_channel_sink(NULL);
+        audio_capture_stop();
+    }
+    if (sys_ready)
+        sys_deinit();
+    SDL_Quit();
+    return 1;
+}
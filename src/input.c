@@ -1,5 +1,6 @@
 #include "input.h"
 #include "bus.h"
+#include "system.h"
 #include <SDL3/SDL.h>
 #include <stdbool.h>
 #include "interrupt.h"
@@ -14,6 +15,9 @@ typedef struct {
     bool pressed;
 
     SDL_Scancode scancode;
+    /* Absolute M-cycle before which a release is held back, so that taps
+       shorter than a frame are still seen by games polling once per frame. */
+    uint64_t release_cycle;
 } button;
 
 typedef enum {
@@ -36,20 +40,129 @@ static button buttons[NUM_BUTTONS] = {
 
 static void load_joyp_nibble();
 
+/* Key transitions from the window thread (single producer) to the emulation
+   thread (single consumer). */
+typedef struct {
+    Uint64 timestamp_ns;
+    byte button;
+    bool pressed;
+} input_event;
+#define EVENT_QUEUE_SIZE 256
+#define EVENT_QUEUE_MASK (EVENT_QUEUE_SIZE - 1)
+static input_event event_queue[EVENT_QUEUE_SIZE];
+static SDL_AtomicInt queue_head;
+static SDL_AtomicInt queue_tail;
+
+/* Host time of cycle 0 of the current frame, and the host time the frame
+   spans. 0: events are due as soon as they arrive. */
+static Uint64 frame_start_ns;
+static Uint64 frame_ns;
+static uint64_t frame_base_cycle;
+static int frame_cycle;
+static bool taking_input;
+
+#define POLL_M_CYCLES 114
+static int poll_countdown;
+
+static void apply_due_events(void);
+
 bool input_init()
 {
     /* DMG boot handoff state. */
     joyp_reg = 0xCF;
 
+    SDL_SetAtomicInt(&queue_head, 0);
+    SDL_SetAtomicInt(&queue_tail, 0);
+    frame_base_cycle = 0;
+    frame_cycle = 0;
+    taking_input = false;
+    poll_countdown = POLL_M_CYCLES;
+
     return true;
 }
 
-void input_poll_and_load()
+/* Called by the window thread. */
+void input_push_key(SDL_Scancode scancode, bool pressed, Uint64 timestamp_ns)
 {
-    const bool *keys = SDL_GetKeyboardState(NULL);
+    int idx = 0;
+    while (idx < NUM_BUTTONS && buttons[idx].scancode != scancode)
+        idx++;
+    if (idx == NUM_BUTTONS)
+        return;
+
+    unsigned int tail = (unsigned int)SDL_GetAtomicInt(&queue_tail);
+    unsigned int head = (unsigned int)SDL_GetAtomicInt(&queue_head);
+    if (tail - head == EVENT_QUEUE_SIZE) {
+        SDL_Log("Input queue full, dropping key event");
+        return;
+    }
+    event_queue[tail & EVENT_QUEUE_MASK] = (input_event){
+        timestamp_ns, (byte)idx, pressed
+    };
+    SDL_SetAtomicInt(&queue_tail, (int)(tail + 1));
+}
+
+void input_begin_frame(Uint64 start_ns, Uint64 span_ns)
+{
+    /* Frames run without input are not counted, since they are undone. */
+    if (taking_input)
+        frame_base_cycle += frame_cycle;
+    frame_cycle = 0;
+    frame_start_ns = start_ns;
+    frame_ns = span_ns;
+    taking_input = start_ns != 0;
+    poll_countdown = POLL_M_CYCLES;
+    if (taking_input)
+        apply_due_events();
+}
+
+void input_tick()
+{
+    frame_cycle++;
+    if (--poll_countdown > 0)
+        return;
+    poll_countdown = POLL_M_CYCLES;
+    if (taking_input)
+        apply_due_events();
+}
+
+/* Applies queued transitions, in order, whose host time maps to an emulated
+   time that has been reached. Emulation normally runs ahead of the host clock,
+   so these are applied as soon as they are seen: a key pressed while the frame
+   is being emulated lands mid-frame, but one pressed while the pacer sleeps
+   lands at the start of the next frame, as when the keyboard was read once
+   per frame. */
+static void apply_due_events()
+{
+    unsigned int head = (unsigned int)SDL_GetAtomicInt(&queue_head);
+    unsigned int tail = (unsigned int)SDL_GetAtomicInt(&queue_tail);
+    if (head == tail)
+        return;
+
+    Uint64 now_ns = frame_start_ns +
+        frame_ns * (Uint64)frame_cycle / M_CYCLES_PER_FRAME;
+    uint64_t cycle = frame_base_cycle + frame_cycle;
+    for (; head != tail; head++) {
+        const input_event *ev = &event_queue[head & EVENT_QUEUE_MASK];
+        button *b = &buttons[ev->button];
+        if (frame_ns != 0 && ev->timestamp_ns > now_ns)
+            break;
+        if (!ev->pressed && cycle < b->release_cycle)
+            break;
+
+        b->pressed = ev->pressed;
+        if (ev->pressed)
+            b->release_cycle = cycle + M_CYCLES_PER_FRAME;
+        load_joyp_nibble();
+    }
+    SDL_SetAtomicInt(&queue_head, (int)head);
+}
+
+void input_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, joyp_reg);
     for (int i = 0; i < NUM_BUTTONS; i++)
-        buttons[i].pressed = keys[buttons[i].scancode];
-    load_joyp_nibble();
+        SNAPSHOT(s, buttons[i].pressed);
 }
 
 static void load_joyp_nibble()
@@ -1,8 +1,13 @@
 #pragma once
 #include "byte.h"
+#include "snapshot.h"
+#include <SDL3/SDL.h>
 
 bool input_init(void);
-void input_poll_and_load(void);
+void input_push_key(SDL_Scancode scancode, bool pressed, Uint64 timestamp_ns);
+void input_begin_frame(Uint64 start_ns, Uint64 span_ns);
+void input_tick(void);
+void input_snapshot(snapshot *s);
 
 byte input_joyp_read(void);
 void input_joyp_write(byte val);
\ No newline at end of file
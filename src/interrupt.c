@@ -31,6 +31,12 @@ bool int_init(void)
     return true;
 }
 
+void int_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, if_reg);
+    SNAPSHOT(s, ie_reg);
+}
+
 byte int_if_read() {
     return if_reg;
 }
@@ -1,5 +1,6 @@
 #pragma once
 #include "byte.h"
+#include "snapshot.h"
 #include <stdbool.h>
 
 typedef enum {
@@ -11,6 +12,7 @@ typedef enum {
 } interrupt_type;
 
 bool int_init(void);
+void int_snapshot(snapshot *s);
 
 byte int_if_read(void);
 void int_if_write(byte val);
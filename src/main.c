@@ -2,13 +2,17 @@
 #include <SDL3/SDL_main.h>
 #include <SDL3/SDL.h>
 #include "system.h"
+#include "pacer.h"
+#include "scaler.h"
+#include "recorder.h"
+#include "shm_export.h"
+#include "audio.h"
+#include "resampler.h"
+#include "apu.h"
 
 #include <stdlib.h>
 #include <stdio.h>
 
-static double target_secs_per_frame
-    = (double)T_CYCLES_PER_FRAME / (double)T_CYCLES_PER_SEC;
-
 static int scale_factor;
 static int window_width;
 static int window_height;
@@ -16,10 +20,9 @@ static SDL_Window *window;
 static SDL_Renderer *renderer;
 static SDL_Texture *window_tex;
 
-#define NUM_PALETTES 2
+#define NUM_PALETTES PPU_NUM_PALETTES
 SDL_Palette *palettes[NUM_PALETTES];
 int active_palette;
-SDL_Palette *bw_palette, *olive_palette;
 static inline SDL_Color color_from_hex(uint32_t hex) {
     return (SDL_Color){
         (hex >> 16) & 0xFF,
@@ -28,45 +31,193 @@ static inline SDL_Color color_from_hex(uint32_t hex) {
         0xFF
     };
 }
+/* Only used by INDEX8 textures -- the other formats are colored by the PPU. */
 static bool init_palettes()
 {
-    bw_palette = SDL_CreatePalette(5);
-    if (bw_palette == NULL)
+    for (int i = 0; i < NUM_PALETTES; i++) {
+        palettes[i] = SDL_CreatePalette(PPU_NUM_COLORS);
+        if (palettes[i] == NULL)
+            return false;
+        const uint32_t *hex = sys_get_palette_colors(i);
+        SDL_Color colors[PPU_NUM_COLORS];
+        for (int j = 0; j < PPU_NUM_COLORS; j++)
+            colors[j] = color_from_hex(hex[j]);
+        if (!SDL_SetPaletteColors(palettes[i], colors, 0, PPU_NUM_COLORS))
+            return false;
+    }
+
+    return true;
+}
+
+/* Multiple of the DMG clock the system thread paces itself to. */
+#define SPEED_UNCAPPED 0
+static const int speed_keys[] = { 1, 2, 4, 8, SPEED_UNCAPPED };
+static SDL_AtomicInt speed;
+/* Emulated T-cycle clock achieved over the last second. */
+static SDL_AtomicInt clock_khz;
+static bool parse_speed(const char *name)
+{
+    int val = strcmp(name, "max") == 0 ? SPEED_UNCAPPED : atoi(name);
+    if (val < 0 || (val == 0 && strcmp(name, "max") != 0)) {
+        SDL_SetError("Invalid speed %s", name);
         return false;
-    SDL_Color bw_colors[5] = {
-        color_from_hex(0xE0E0E0),
-        color_from_hex(0xB0B0B0),
-        color_from_hex(0x707070),
-        color_from_hex(0x303030),
-        color_from_hex(0xF0F0F0)
-    };
-    if (!SDL_SetPaletteColors(bw_palette, bw_colors,0, 5))
+    }
+    SDL_SetAtomicInt(&speed, val);
+    return true;
+}
+
+static pace_policy pacing = PACE_CATCH_UP;
+static bool parse_pacing(const char *name)
+{
+    if (strcmp(name, "catch-up") == 0)
+        pacing = PACE_CATCH_UP;
+    else if (strcmp(name, "skip") == 0)
+        pacing = PACE_SKIP;
+    else if (strcmp(name, "reset") == 0)
+        pacing = PACE_RESET;
+    else {
+        SDL_SetError("Unknown pacing policy %s", name);
         return false;
-    palettes[0] = bw_palette;
+    }
+    return true;
+}
 
-    olive_palette = SDL_CreatePalette(5);
-    if (olive_palette == NULL)
+/* What emulation keeps pace with at 1x speed. */
+typedef enum {
+    SYNC_VIDEO, /* The host clock, through the pacer. */
+    SYNC_AUDIO, /* The audio device, by waiting for queued samples to play. */
+    SYNC_NONE   /* Nothing -- as fast as possible, without sound. */
+} sync_mode;
+#define NUM_SYNC_MODES 3
+static const char *sync_names[NUM_SYNC_MODES] = { "video", "audio", "none" };
+/* Set by the window thread, F6 cycling through the modes. */
+static SDL_AtomicInt sync_mode_set;
+static bool parse_sync(const char *name)
+{
+    int mode = 0;
+    while (mode < NUM_SYNC_MODES && strcmp(name, sync_names[mode]) != 0)
+        mode++;
+    if (mode == NUM_SYNC_MODES) {
+        SDL_SetError("Unknown sync mode %s", name);
         return false;
-    SDL_Color olive_colors[5] = {
-        color_from_hex(0x9CA142),
-        color_from_hex(0x4C722B),
-        color_from_hex(0x0C440C),
-        color_from_hex(0x1F2F0F),
-        color_from_hex(0xAAAF48)
-    };
-    if (!SDL_SetPaletteColors(olive_palette, olive_colors, 0, 5))
+    }
+    SDL_SetAtomicInt(&sync_mode_set, mode);
+    return true;
+}
+static bool show_overlay = false;
+
+/* Most frames in a row emulated without pixels while behind, 0 for none. */
+static int frameskip = 0;
+
+/* Posted to the window thread when a frame has been published. */
+static Uint32 frame_ready_event;
+static SDL_AtomicInt frame_event_pending;
+#define TITLE_UPDATE_MS 250
+
+/* Frames emulated past the shown one, to hide the game's own input lag. */
+static int run_ahead = 0;
+static sys_snapshot run_ahead_snap;
+/* Host time spent on run-ahead per frame, averaged over the last second. */
+static SDL_AtomicInt run_ahead_us;
+static Uint64 run_ahead_total_ns;
+static Uint64 run_ahead_total_frames;
+
+static ppu_format frame_format = PPU_FORMAT_RGBA8888;
+static bool threaded_render = false;
+static bool incremental_render = false;
+static bool parse_format(const char *name)
+{
+    if (strcmp(name, "index8") == 0)
+        frame_format = PPU_FORMAT_INDEX8;
+    else if (strcmp(name, "rgba8888") == 0)
+        frame_format = PPU_FORMAT_RGBA8888;
+    else if (strcmp(name, "rgb565") == 0)
+        frame_format = PPU_FORMAT_RGB565;
+    else {
+        SDL_SetError("Unknown frame format %s", name);
         return false;
-    palettes[1] = olive_palette;
+    }
+    return true;
+}
+static SDL_PixelFormat texture_format(ppu_format format)
+{
+    switch (format) {
+        case PPU_FORMAT_INDEX8:   return SDL_PIXELFORMAT_INDEX8;
+        case PPU_FORMAT_RGB565:   return SDL_PIXELFORMAT_RGB565;
+        case PPU_FORMAT_RGBA8888:
+        default:                  return SDL_PIXELFORMAT_RGBA8888;
+    }
+}
 
+/* CPU upscaling before upload. The filter output follows the window scale,
+   and SDL scales the rest of the way by an integer factor. */
+typedef enum {
+    FILTER_NONE,
+    FILTER_NEAREST,
+    FILTER_SCALE,   /* Scale2x, Scale3x or Scale4x. */
+    FILTER_XBR
+} filter_family;
+static filter_family filter = FILTER_NONE;
+static int filter_threads = 0;
+static bool scaler_ready = false;
+static scaler_filter active_filter;
+/* Size of the window texture relative to the frame. */
+static int tex_factor = 1;
+/* The frame last acquired, kept for refiltering. */
+static const void *shown_frame;
+static bool parse_filter(const char *name)
+{
+    if (strcmp(name, "none") == 0)
+        filter = FILTER_NONE;
+    else if (strcmp(name, "nearest") == 0)
+        filter = FILTER_NEAREST;
+    else if (strcmp(name, "scale") == 0)
+        filter = FILTER_SCALE;
+    else if (strcmp(name, "xbr") == 0)
+        filter = FILTER_XBR;
+    else {
+        SDL_SetError("Unknown filter %s", name);
+        return false;
+    }
     return true;
 }
 
+/* Recording of every emulated frame. Drops frames rather than slowing
+   emulation down, by default. */
+static recorder_args rec_args = {
+    .format = REC_FORMAT_Y4M, .policy = REC_DROP, .buffers = 16
+};
+static bool recording = false;
+/* Shared-memory object the state is exported to. */
+static const char *export_name = NULL;
+static bool exporting = false;
+
+#define AUDIO_RATE 48000
+static bool audio_enabled = true;
+static int audio_latency_ms = 50;
+static bool audio_ready = false;
+/* Whether samples are played, and whether they are muted for the frames
+   being emulated, e.g. for run-ahead. System thread only. */
+static bool audio_audible = false;
+static bool audio_muted = false;
+/* Longest wait for the audio device in SYNC_AUDIO, in case it stalls. */
+#define AUDIO_SYNC_TIMEOUT_MS 100
+/* Whether the APU runs at its native rate and is decimated to AUDIO_RATE,
+   rather than synthesizing at AUDIO_RATE directly. */
+static bool resampling = false;
+static resampler_quality resample_quality;
+static bool resampler_ready = false;
+#define RESAMPLE_CHUNK 512
+
 const char *rom_path;
 static bool running = true;
 
-SDL_Mutex *frame_mux;
 static SDL_Thread *system_thread;
 static void loop_window(void);
+static bool select_filter(int scale);
+static void on_frame_ready(void);
+static void on_frame_tap(const void *frame);
+static void on_audio_samples(const int16_t *samples, int frames);
 static int loop_system(void* data);
 
 int main(int argc, char *argv[])
@@ -75,7 +226,95 @@ int main(int argc, char *argv[])
 
     bool sdl_init = SDL_Init(SDL_INIT_VIDEO | SDL_INIT_EVENTS); 
     if (!sdl_init) goto failure;
+
+    /* Usage: mydmg [--format index8|rgba8888|rgb565] [--render-thread]
+                   [--incremental] [--speed N|max] [--run-ahead K]
+                   [--pacing catch-up|skip|reset] [--sync video|audio|none]
+                   [--frameskip N]
+                   [--filter none|nearest|scale|xbr] [--filter-threads N]
+                   [--record PATH] [--record-format y4m|raw]
+                   [--record-policy block|drop] [--record-buffers N]
+                   [--export-shm NAME] [--no-audio] [--audio-latency MS]
+                   [--resample fast|medium|best] [ROM path] */
+    SDL_SetAtomicInt(&speed, 1);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--format") == 0 && i + 1 < argc) {
+            if (!parse_format(argv[++i])) goto failure;
+        }
+        else if (strcmp(argv[i], "--speed") == 0 && i + 1 < argc) {
+            if (!parse_speed(argv[++i])) goto failure;
+        }
+        else if (strcmp(argv[i], "--pacing") == 0 && i + 1 < argc) {
+            if (!parse_pacing(argv[++i])) goto failure;
+        }
+        else if (strcmp(argv[i], "--sync") == 0 && i + 1 < argc) {
+            if (!parse_sync(argv[++i])) goto failure;
+        }
+        else if (strcmp(argv[i], "--frameskip") == 0 && i + 1 < argc) {
+            i++;
+            frameskip = SDL_max(atoi(argv[i]), 0);
+        }
+        else if (strcmp(argv[i], "--run-ahead") == 0 && i + 1 < argc) {
+            i++;
+            run_ahead = SDL_max(atoi(argv[i]), 0);
+        }
+        else if (strcmp(argv[i], "--filter") == 0 && i + 1 < argc) {
+            if (!parse_filter(argv[++i])) goto failure;
+        }
+        else if (strcmp(argv[i], "--filter-threads") == 0 && i + 1 < argc) {
+            i++;
+            filter_threads = SDL_max(atoi(argv[i]), 1);
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            rec_args.path = argv[++i];
+        else if (strcmp(argv[i], "--record-format") == 0 && i + 1 < argc) {
+            if (!recorder_parse_format(argv[++i], &rec_args.format)) goto failure;
+        }
+        else if (strcmp(argv[i], "--record-policy") == 0 && i + 1 < argc) {
+            if (!recorder_parse_policy(argv[++i], &rec_args.policy)) goto failure;
+        }
+        else if (strcmp(argv[i], "--record-buffers") == 0 && i + 1 < argc)
+            rec_args.buffers = atoi(argv[++i]);
+        else if (strcmp(argv[i], "--export-shm") == 0 && i + 1 < argc)
+            export_name = argv[++i];
+        else if (strcmp(argv[i], "--no-audio") == 0)
+            audio_enabled = false;
+        else if (strcmp(argv[i], "--audio-latency") == 0 && i + 1 < argc) {
+            i++;
+            audio_latency_ms = SDL_max(atoi(argv[i]), 10);
+        }
+        else if (strcmp(argv[i], "--resample") == 0 && i + 1 < argc) {
+            if (!resampler_parse_quality(argv[++i], &resample_quality))
+                goto failure;
+            resampling = true;
+        }
+        else if (strcmp(argv[i], "--render-thread") == 0)
+            threaded_render = true;
+        else if (strcmp(argv[i], "--incremental") == 0)
+            incremental_render = true;
+        else if (rom_path == NULL)
+            rom_path = strdup(argv[i]);
+    }
     
+    if (export_name != NULL && threaded_render) {
+        /* Frames would complete on the render thread, out of step with the
+           rest of the state. */
+        SDL_SetError("--export-shm is not supported with --render-thread");
+        goto failure;
+    }
+
+    if (filter != FILTER_NONE) {
+        /* The filters work on 32-bit pixels. */
+        if (frame_format != PPU_FORMAT_RGBA8888) {
+            SDL_SetError("Filters need --format rgba8888");
+            goto failure;
+        }
+        if (filter_threads == 0)
+            filter_threads = SDL_clamp(SDL_GetNumLogicalCPUCores() / 2, 1, 4);
+        if (!scaler_init(filter_threads)) goto failure;
+        scaler_ready = true;
+    }
+
     scale_factor = 4;
     window_width = GB_WIDTH * scale_factor;
     window_height = GB_HEIGHT * scale_factor;
@@ -87,22 +326,15 @@ int main(int argc, char *argv[])
     if (!SDL_SetRenderVSync(renderer, 1))
         SDL_Log("Could not initialize renderer with VSync");
     
-    window_tex = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_INDEX8,
-            SDL_TEXTUREACCESS_STREAMING, GB_WIDTH, GB_HEIGHT);
-    if (window_tex == NULL) goto failure;
-    if (!SDL_SetTextureScaleMode(window_tex, SDL_SCALEMODE_PIXELART)) goto failure;
+    if (!select_filter(scale_factor)) goto failure;
 
     if (!init_palettes()) goto failure;
     active_palette = 0;
-    if (!SDL_SetTexturePalette(window_tex, palettes[active_palette]))
+    if (frame_format == PPU_FORMAT_INDEX8 &&
+        !SDL_SetTexturePalette(window_tex, palettes[active_palette]))
         goto failure;
 
-    frame_mux = SDL_CreateMutex();
-    if (frame_mux == NULL) goto failure;
-
-    if (argc >= 2)
-        rom_path = strdup(argv[1]);
-    else {
+    if (rom_path == NULL) {
         while (true) {
             SDL_Event event;
             SDL_WaitEvent(&event);
@@ -115,12 +347,104 @@ int main(int argc, char *argv[])
         }
     }
 
-    system_args sys_args = (system_args){ rom_path, frame_mux };
+    if (!audio_enabled)
+        resampling = false;
+    system_args sys_args = (system_args){
+        rom_path, frame_format, threaded_render, incremental_render,
+        resampling ? APU_NATIVE_RATE : AUDIO_RATE, true
+    };
+    frame_ready_event = SDL_RegisterEvents(1);
+    if (frame_ready_event == 0)
+        goto failure;
     if (!sys_init(sys_args))
         goto failure;
+    sys_set_frame_ready_callback(&on_frame_ready);
+    if (rec_args.path != NULL) {
+        rec_args.frame_format = frame_format;
+        rec_args.palette = sys_get_palette_colors(active_palette);
+        if (!recorder_start(rec_args))
+            goto failure;
+        recording = true;
+    }
+    if (export_name != NULL) {
+        if (!shm_export_start(export_name, frame_format))
+            goto failure;
+        exporting = true;
+    }
+    if (recording || exporting)
+        sys_set_frame_tap(&on_frame_tap);
+    if (audio_enabled) {
+        /* Runs silent rather than not at all without an audio device. */
+        audio_ready = audio_init(AUDIO_RATE, audio_latency_ms);
+        if (audio_ready)
+            sys_set_audio_sink(&on_audio_samples);
+        else
+            SDL_Log("Could not open audio: %s", SDL_GetError());
+    }
+    if (audio_ready && resampling) {
+        if (!resampler_init(APU_NATIVE_RATE, AUDIO_RATE, resample_quality))
+            goto failure;
+        resampler_ready = true;
+        SDL_Log("Resampling with %d taps (%s)", resampler_get_taps(),
+            resampler_isa_name(resampler_get_isa()));
+    }
+    if (SDL_GetAtomicInt(&sync_mode_set) == SYNC_AUDIO && !audio_ready) {
+        SDL_Log("Syncing to video, without audio");
+        SDL_SetAtomicInt(&sync_mode_set, SYNC_VIDEO);
+    }
+    if (frameskip > 0 && threaded_render)
+        SDL_Log("Frameskip is not supported with the render thread");
+    if (run_ahead > 0 && !sys_snapshot_init(&run_ahead_snap))
+        goto failure;
+    if (!pacer_init(pacing))
+        goto failure;
     system_thread = SDL_CreateThread(&loop_system, "MyDMG system", NULL);
     loop_window();
     SDL_WaitThread(system_thread, NULL);
+    pace_stats pace = pacer_get_stats();
+    SDL_Log("%llu frames paced, %llu missed, %llu skipped, %llu resets; "
+        "emulation p99 %.2f ms, overshoot p99 %.3f ms, present p99 %.2f ms",
+        (unsigned long long)pace.frames, (unsigned long long)pace.missed,
+        (unsigned long long)pace.skipped, (unsigned long long)pace.resets,
+        pace_hist_percentile(&pace.emulation, 0.99) / 1e6,
+        pace_hist_percentile(&pace.overshoot, 0.99) / 1e6,
+        pace_hist_percentile(&pace.present, 0.99) / 1e6);
+    pacer_deinit();
+    if (recording) {
+        recorder_stop();
+        recorder_stats rec = recorder_get_stats();
+        SDL_Log("Recorded %llu frames (%llu dropped, %llu skipped) in %llu writes "
+            "of %.1f MiB; blocked for %.1f ms",
+            (unsigned long long)rec.frames, (unsigned long long)rec.dropped,
+            (unsigned long long)rec.skipped, (unsigned long long)rec.writes,
+            rec.bytes / 1048576.0, rec.blocked_ns / 1e6);
+        recording = false;
+    }
+    if (exporting) {
+        shm_export_stop();
+        exporting = false;
+    }
+    if (audio_ready) {
+        audio_stats audio = audio_get_stats();
+        SDL_Log("Audio: %llu underruns (%llu frames of silence), %llu frames "
+            "dropped, drain ratio %.4f",
+            (unsigned long long)audio.underruns,
+            (unsigned long long)audio.silent_frames,
+            (unsigned long long)audio.dropped_frames, audio.ratio);
+    }
+    ppu_frame_stats stats = sys_get_frame_stats();
+    SDL_Log("%llu frames (%llu dropped, %llu duplicated, %llu skipped)",
+        (unsigned long long)stats.published,
+        (unsigned long long)stats.dropped,
+        (unsigned long long)stats.duplicated,
+        (unsigned long long)stats.skipped);
+    if (run_ahead > 0) {
+        SDL_Log("Run-ahead of %d frames: %.3f ms per frame, %zu byte snapshots",
+            run_ahead,
+            (double)run_ahead_total_ns / 1e6 / SDL_max(run_ahead_total_frames, 1),
+            run_ahead_snap.size);
+        sys_snapshot_deinit(&run_ahead_snap);
+    }
     sys_deinit();
     
 close:
@@ -130,7 +454,11 @@ close:
     for (int i = 0; i < NUM_PALETTES; i++) {
         if (palettes[i] != NULL) SDL_DestroyPalette(palettes[i]);
     }
-    if (frame_mux != NULL) SDL_DestroyMutex(frame_mux);
+    if (recording) recorder_stop();
+    if (exporting) shm_export_stop();
+    if (audio_ready) audio_deinit();
+    if (resampler_ready) resampler_deinit();
+    if (scaler_ready) scaler_deinit();
     if (rom_path != NULL) free(rom_path);
     if (sdl_init) SDL_Quit();
     return code;
@@ -140,60 +468,406 @@ failure:
     goto close;
 }
 
-static void loop_window()
+/* Uploads the rows of the frame that changed (or all of them), in contiguous
+   runs. Filtered frames are always scaled and uploaded whole. */
+static void upload_frame(const void *frame, bool all_rows)
 {
-    /* Main loop. */
-    while (running) {
-        SDL_RenderClear(renderer);
-        SDL_LockMutex(frame_mux);
+    int pitch = sys_get_frame_pitch();
+    if (tex_factor > 1) {
         void *pixels;
-        int pitch;
-        SDL_LockTexture(window_tex, NULL, &pixels, &pitch);
-        memcpy(pixels, sys_get_frame_buffer(), GB_WIDTH * GB_HEIGHT);
-        SDL_UnlockTexture(window_tex);
-        SDL_UnlockMutex(frame_mux);
-        SDL_RenderTexture(renderer, window_tex, NULL, NULL);
-        SDL_RenderPresent(renderer);
+        int tex_pitch;
+        if (SDL_LockTexture(window_tex, NULL, &pixels, &tex_pitch)) {
+            scaler_run(active_filter, tex_factor, frame, pitch,
+                pixels, tex_pitch);
+            SDL_UnlockTexture(window_tex);
+        }
+        return;
+    }
 
-        SDL_Event event;
-        while (SDL_PollEvent(&event)) {
-            if (event.type == SDL_EVENT_WINDOW_CLOSE_REQUESTED) {
-                running = false;
+    const bool *dirty = sys_get_dirty_lines();
+    int y = 0;
+    while (y < GB_HEIGHT) {
+        if (!all_rows && !dirty[y]) {
+            y++;
+            continue;
+        }
+        int start = y;
+        while (y < GB_HEIGHT && (all_rows || dirty[y]))
+            y++;
+        SDL_Rect rows = { 0, start, GB_WIDTH, y - start };
+        SDL_UpdateTexture(window_tex, &rows,
+            (const byte *)frame + start * pitch, pitch);
+    }
+}
+
+static void draw_hist_line(float y, const char *name, const pace_histogram *hist)
+{
+    SDL_RenderDebugTextFormat(renderer, 4, y,
+        "%-9s p50 %6.2f  p99 %6.2f  max %6.2f ms", name,
+        pace_hist_percentile(hist, 0.5) / 1e6,
+        pace_hist_percentile(hist, 0.99) / 1e6,
+        hist->max_ns / 1e6);
+}
+
+static SDL_Texture *create_window_tex(int factor)
+{
+    SDL_Texture *tex = SDL_CreateTexture(renderer, texture_format(frame_format),
+        SDL_TEXTUREACCESS_STREAMING, GB_WIDTH * factor, GB_HEIGHT * factor);
+    if (tex != NULL && !SDL_SetTextureScaleMode(tex, SDL_SCALEMODE_PIXELART)) {
+        SDL_DestroyTexture(tex);
+        return NULL;
+    }
+    return tex;
+}
+
+/* Picks the filter output for a window scale, recreating the window texture
+   when its size changes. Scale2x/3x/4x and 2xBR are only used for the window
+   scales their factor divides. */
+static bool select_filter(int scale)
+{
+    int factor = 1;
+    switch (filter) {
+        case FILTER_NONE:
+            break;
+        case FILTER_NEAREST:
+            active_filter = SCALER_NEAREST;
+            factor = scale;
+            break;
+        case FILTER_SCALE:
+            if (scale % 4 == 0)
+                active_filter = SCALER_SCALE4X;
+            else if (scale % 3 == 0)
+                active_filter = SCALER_SCALE3X;
+            else if (scale % 2 == 0)
+                active_filter = SCALER_SCALE2X;
+            else
                 break;
+            factor = scaler_output_factor(active_filter, scale);
+            break;
+        case FILTER_XBR:
+            if (scale % 2 == 0) {
+                active_filter = SCALER_XBR2X;
+                factor = 2;
             }
-            else if (event.type == SDL_EVENT_KEY_DOWN) {
-                if (event.key.scancode >= SDL_SCANCODE_1 &&
-                    event.key.scancode <= SDL_SCANCODE_9) {
-                    scale_factor = event.key.scancode - SDL_SCANCODE_1 + 1;
-                    window_width = scale_factor * GB_WIDTH;
-                    window_height = scale_factor * GB_HEIGHT;
-                    SDL_SetWindowSize(window, window_width, window_height);
-                }
-                else if (event.key.scancode == SDL_SCANCODE_P) {
-                    active_palette = (active_palette + 1) % NUM_PALETTES;
-                    SDL_SetTexturePalette(window_tex, palettes[active_palette]);
-                }
+            break;
+    }
+
+    if (window_tex == NULL || factor != tex_factor) {
+        SDL_Texture *tex = create_window_tex(factor);
+        if (tex == NULL)
+            return false;
+        if (window_tex != NULL)
+            SDL_DestroyTexture(window_tex);
+        window_tex = tex;
+        tex_factor = factor;
+    }
+    if (shown_frame != NULL)
+        upload_frame(shown_frame, true);
+    return true;
+}
+
+/* Pacing statistics, drawn over the frame. */
+static void draw_overlay(void)
+{
+    pace_stats pace = pacer_get_stats();
+    SDL_SetRenderDrawColor(renderer, 0xFF, 0x00, 0xFF, 0xFF);
+
+    SDL_RenderDebugTextFormat(renderer, 4, 4,
+        "frames %llu  missed %llu  skipped %llu  resets %llu",
+        (unsigned long long)pace.frames, (unsigned long long)pace.missed,
+        (unsigned long long)pace.skipped, (unsigned long long)pace.resets);
+    SDL_RenderDebugTextFormat(renderer, 4, 14, "lateness %+.3f ms",
+        pace.lateness_ns / 1e6);
+    draw_hist_line(24, "emulation", &pace.emulation);
+    draw_hist_line(34, "overshoot", &pace.overshoot);
+    draw_hist_line(44, "present", &pace.present);
+
+    ppu_frame_stats frames = sys_get_frame_stats();
+    uint64_t shown = frames.published + frames.skipped;
+    SDL_RenderDebugTextFormat(renderer, 4, 54, "frameskip %llu (%.1f%%)",
+        (unsigned long long)frames.skipped,
+        shown > 0 ? 100.0 * frames.skipped / shown : 0.0);
+
+    if (audio_ready) {
+        audio_stats audio = audio_get_stats();
+        SDL_RenderDebugTextFormat(renderer, 4, 64,
+            "audio fill %d (%d-%d, target %d)  ratio %.4f  underruns %llu  "
+            "dropped %llu",
+            audio.fill, audio.fill_min, audio.fill_max, audio.target,
+            audio.ratio, (unsigned long long)audio.underruns,
+            (unsigned long long)audio.dropped_frames);
+        apu_stats apu = sys_get_apu_stats();
+        SDL_RenderDebugTextFormat(renderer, 4, 74, "apu idle %.1f%%",
+            apu.flushes > 0 ? 100.0 * apu.idle_flushes / apu.flushes : 0.0);
+    }
+
+    SDL_SetRenderDrawColor(renderer, 0x00, 0x00, 0x00, 0xFF);
+}
+
+/* Shows the achieved clock and the run-ahead cost in the title, when they
+   change. */
+static void update_title(int *shown_khz, int *shown_us)
+{
+    int khz = SDL_GetAtomicInt(&clock_khz);
+    int us = SDL_GetAtomicInt(&run_ahead_us);
+    if (khz == *shown_khz && us == *shown_us)
+        return;
+    *shown_khz = khz;
+    *shown_us = us;
+
+    char title[96];
+    int len;
+    int cur_speed = SDL_GetAtomicInt(&speed);
+    if (cur_speed == SPEED_UNCAPPED)
+        len = snprintf(title, sizeof(title), "MyDMG - %.2f MHz (uncapped)", khz / 1000.0);
+    else
+        len = snprintf(title, sizeof(title), "MyDMG - %.2f MHz (%dx)", khz / 1000.0, cur_speed);
+    if (run_ahead > 0)
+        snprintf(title + len, sizeof(title) - len, " - run-ahead %d: %.2f ms",
+            run_ahead, us / 1000.0);
+    SDL_SetWindowTitle(window, title);
+}
+
+/* Returns whether the window has to be redrawn. */
+static bool handle_event(const SDL_Event *event)
+{
+    if (event->type == SDL_EVENT_WINDOW_CLOSE_REQUESTED) {
+        running = false;
+        return false;
+    }
+    if (event->type == SDL_EVENT_WINDOW_EXPOSED ||
+        event->type == SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED)
+        return true;
+
+    if ((event->type == SDL_EVENT_KEY_DOWN ||
+         event->type == SDL_EVENT_KEY_UP) && !event->key.repeat)
+        sys_push_key(event->key.scancode, event->key.down,
+            event->key.timestamp);
+
+    if (event->type != SDL_EVENT_KEY_DOWN)
+        return false;
+    if (event->key.scancode >= SDL_SCANCODE_1 &&
+        event->key.scancode <= SDL_SCANCODE_9) {
+        scale_factor = event->key.scancode - SDL_SCANCODE_1 + 1;
+        window_width = scale_factor * GB_WIDTH;
+        window_height = scale_factor * GB_HEIGHT;
+        SDL_SetWindowSize(window, window_width, window_height);
+        if (!select_filter(scale_factor))
+            SDL_Log("Could not change the filter: %s", SDL_GetError());
+        return true;
+    }
+    else if (event->key.scancode >= SDL_SCANCODE_F1 &&
+             event->key.scancode <= SDL_SCANCODE_F5) {
+        SDL_SetAtomicInt(&speed,
+            speed_keys[event->key.scancode - SDL_SCANCODE_F1]);
+    }
+    else if (event->key.scancode == SDL_SCANCODE_F6) {
+        int mode = (SDL_GetAtomicInt(&sync_mode_set) + 1) % NUM_SYNC_MODES;
+        if (mode == SYNC_AUDIO && !audio_ready)
+            mode++;
+        SDL_SetAtomicInt(&sync_mode_set, mode);
+        SDL_Log("Syncing to %s", sync_names[mode]);
+    }
+    else if (event->key.scancode == SDL_SCANCODE_O) {
+        show_overlay = !show_overlay;
+        return true;
+    }
+    else if (event->key.scancode == SDL_SCANCODE_P) {
+        active_palette = (active_palette + 1) % NUM_PALETTES;
+        if (frame_format == PPU_FORMAT_INDEX8) {
+            SDL_SetTexturePalette(window_tex, palettes[active_palette]);
+            return true;
+        }
+        sys_select_palette(active_palette);
+    }
+    return false;
+}
+
+/* Called by the thread publishing frames. At most one event is queued. */
+static void on_frame_ready(void)
+{
+    if (SDL_CompareAndSwapAtomicInt(&frame_event_pending, 0, 1)) {
+        SDL_Event event = { .type = frame_ready_event };
+        SDL_PushEvent(&event);
+    }
+}
+
+/* Called by the emulation thread when a frame completes. */
+static void on_frame_tap(const void *frame)
+{
+    if (recording)
+        recorder_push_frame(frame);
+    if (exporting)
+        shm_export_publish(frame);
+}
+
+/* Called by the emulation thread. */
+static void on_audio_samples(const int16_t *samples, int frames)
+{
+    if (!audio_audible || audio_muted)
+        return;
+    if (!resampling) {
+        audio_push(samples, frames);
+        return;
+    }
+    static int16_t resampled[(RESAMPLE_CHUNK + 1) * 2];
+    for (int done = 0; done < frames; done += RESAMPLE_CHUNK) {
+        int n = SDL_min(frames - done, RESAMPLE_CHUNK);
+        int out = resampler_process(&samples[done * 2], n, resampled);
+        if (out > 0)
+            audio_push(resampled, out);
+    }
+}
+
+static void loop_window()
+{
+    int shown_khz = 0;
+    int shown_us = 0;
+    bool redraw = true;
+
+    /* Main loop -- sleeps until a frame is published or another event
+       arrives, and presents only when there is something new to show. The
+       timeout keeps the title up to date. */
+    while (running) {
+        update_title(&shown_khz, &shown_us);
+
+        bool frame_ready = false;
+        SDL_Event event;
+        if (SDL_WaitEventTimeout(&event, TITLE_UPDATE_MS)) {
+            do {
+                if (event.type == frame_ready_event)
+                    frame_ready = true;
+                else if (handle_event(&event))
+                    redraw = true;
+            } while (running && SDL_PollEvent(&event));
+        }
+        if (!running)
+            break;
+
+        if (frame_ready) {
+            SDL_SetAtomicInt(&frame_event_pending, 0);
+            /* The acquired frame belongs to this thread until the next
+               acquire, so it can be uploaded without locking. */
+            bool new_frame;
+            const void *frame = sys_acquire_frame(&new_frame);
+            if (new_frame) {
+                shown_frame = frame;
+                upload_frame(frame, false);
+                redraw = true;
             }
         }
+        if (!redraw)
+            continue;
+        redraw = false;
+
+        SDL_RenderClear(renderer);
+        SDL_RenderTexture(renderer, window_tex, NULL, NULL);
+        if (show_overlay)
+            draw_overlay();
+        Uint64 present_start = SDL_GetTicksNS();
+        SDL_RenderPresent(renderer);
+        pacer_record_present(SDL_GetTicksNS() - present_start);
+    }
+}
+
+static void run_frame(Uint64 start_ns, Uint64 span_ns)
+{
+    sys_start_frame(start_ns, span_ns);
+    for (int i = 0; i < M_CYCLES_PER_FRAME; i++)
+        sys_tick();
+}
+
+/* Emulates the next frame, then run_ahead more from a snapshot of it, shows the
+   last one and goes back to the snapshot. Only the last two generate pixels,
+   since the shown frame can begin during the one before it.
+   Returns the host time spent beyond the first frame. */
+static Uint64 run_frame_ahead(Uint64 start_ns, Uint64 span_ns)
+{
+    sys_set_frame_output(run_ahead == 1, false);
+    run_frame(start_ns, span_ns);
+
+    Uint64 start = SDL_GetTicksNS();
+    sys_save_snapshot(&run_ahead_snap);
+    audio_muted = true;
+    for (int k = 1; k <= run_ahead; k++) {
+        sys_set_frame_output(k >= run_ahead - 1, k == run_ahead);
+        /* Keeps the input of the real frame. */
+        run_frame(0, 0);
     }
+    audio_muted = false;
+    sys_load_snapshot(&run_ahead_snap);
+    return SDL_GetTicksNS() - start;
+}
+
+/* Sets what emulation keeps pace with at the given speed. Sound is only
+   played at 1x, so the audio device can only be synced to then. Returns
+   whether it is. */
+static bool set_pace(int cur_speed, sync_mode sync)
+{
+    bool audio_clock = sync == SYNC_AUDIO && cur_speed == 1;
+    audio_audible = audio_ready && cur_speed == 1 && sync != SYNC_NONE;
+    if (audio_ready)
+        audio_set_sync(audio_clock);
+    /* The pacer still measures frames when not sleeping. */
+    pacer_set_speed(audio_clock || sync == SYNC_NONE ? 0 : cur_speed);
+    return audio_clock;
 }
 
 static int loop_system(void *_)
 {
-    Uint64 counter_freq = SDL_GetPerformanceFrequency();
-    Uint64 next_frame = SDL_GetPerformanceCounter();
+    int prev_speed = SDL_GetAtomicInt(&speed);
+    sync_mode prev_sync = SDL_GetAtomicInt(&sync_mode_set);
+    bool audio_clock = set_pace(prev_speed, prev_sync);
+
+    Uint64 report_start = SDL_GetTicksNS();
+    Uint64 report_cycles = 0;
+    Uint64 report_run_ahead_ns = 0;
+    int skip_run = 0;
+
     while (running) {
-        next_frame += (Uint64)(target_secs_per_frame * counter_freq);
+        int cur_speed = SDL_GetAtomicInt(&speed);
+        sync_mode cur_sync = SDL_GetAtomicInt(&sync_mode_set);
+        if (cur_speed != prev_speed || cur_sync != prev_sync) {
+            /* Pace from now on, rather than catching up with the old speed. */
+            audio_clock = set_pace(cur_speed, cur_sync);
+            prev_speed = cur_speed;
+            prev_sync = cur_sync;
+        }
+
+        /* Skip the pixels of up to frameskip frames in a row while behind.
+           The most recent rendered frame stays on screen meanwhile. */
+        bool skip = pacer_is_behind() && skip_run < frameskip;
+        skip_run = skip ? skip_run + 1 : 0;
+        sys_request_frame_skip(skip);
 
-        sys_start_frame();
-        for (int i = 0; i < M_CYCLES_PER_FRAME; i++)
-            sys_tick();
+        pacer_begin_frame();
+        Uint64 start_ns = SDL_GetTicksNS();
+        Uint64 span_ns = pacer_frame_ns();
+        if (run_ahead > 0) {
+            Uint64 ns = run_frame_ahead(start_ns, span_ns);
+            report_run_ahead_ns += ns;
+            run_ahead_total_ns += ns;
+            run_ahead_total_frames++;
+        }
+        else
+            run_frame(start_ns, span_ns);
 
-        Uint64 now = SDL_GetPerformanceCounter();
-        Sint64 delta = (Sint64)(next_frame - now);
-        if (delta > 0) {
-            SDL_DelayPrecise((double)delta / (double)counter_freq * 1e9);
+        Uint64 now = SDL_GetTicksNS();
+        report_cycles += T_CYCLES_PER_FRAME;
+        if (now - report_start >= 1000000000ull) {
+            Uint64 frames = report_cycles / T_CYCLES_PER_FRAME;
+            SDL_SetAtomicInt(&clock_khz, (int)(report_cycles * 1000000ull /
+                (now - report_start)));
+            SDL_SetAtomicInt(&run_ahead_us, (int)(report_run_ahead_ns / frames / 1000));
+            report_start = now;
+            report_cycles = 0;
+            report_run_ahead_ns = 0;
         }
+
+        pacer_end_frame();
+        /* Video is shown as frames come, at whatever rate this settles at. */
+        if (audio_clock)
+            audio_wait_drained(AUDIO_SYNC_TIMEOUT_MS);
     }
     return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,198 @@
+#include "pacer.h"
+#include <SDL3/SDL.h>
+
+#ifdef __linux__
+#include <time.h>
+#include <errno.h>
+#endif
+
+/* Frame pacing against absolute deadlines. */
+
+/* 70224 T-cycles at 2^22 Hz is exactly 16742706 + 1224/4096 ns. */
+#define FRAME_NS_INT  16742706ull
+#define FRAME_NS_FRAC 1224ull
+#define FRAME_NS_FRAC_BITS 12
+
+static pace_policy policy;
+static int speed;
+
+/* Deadline of frame n is grid_origin + offset(n). */
+static uint64_t grid_origin;
+static uint64_t grid_frame;
+static uint64_t frame_begin;
+static bool behind;
+
+static SDL_Mutex *stats_lock;
+static pace_stats stats;
+
+static uint64_t now_ns(void)
+{
+#ifdef __linux__
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+#else
+    return SDL_GetTicksNS();
+#endif
+}
+
+static void sleep_until(uint64_t deadline)
+{
+#ifdef __linux__
+    struct timespec ts = {
+        (time_t)(deadline / 1000000000ull), (long)(deadline % 1000000000ull)
+    };
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+#else
+    uint64_t now = now_ns();
+    if (deadline > now)
+        SDL_DelayPrecise(deadline - now);
+#endif
+}
+
+static uint64_t grid_offset(uint64_t n)
+{
+    return (n * FRAME_NS_INT + ((n * FRAME_NS_FRAC) >> FRAME_NS_FRAC_BITS)) / speed;
+}
+
+static void hist_add(pace_histogram *hist, uint64_t ns)
+{
+    int bucket = 0;
+    for (uint64_t us = ns / 1000; us > 0 && bucket < PACE_HIST_BUCKETS - 1; us >>= 1)
+        bucket++;
+    hist->counts[bucket]++;
+    hist->total++;
+    hist->sum_ns += ns;
+    if (ns > hist->max_ns)
+        hist->max_ns = ns;
+}
+
+bool pacer_init(pace_policy _policy)
+{
+    policy = _policy;
+    behind = false;
+    stats = (pace_stats){ 0 };
+    stats_lock = SDL_CreateMutex();
+    if (stats_lock == NULL)
+        return false;
+    pacer_set_speed(1);
+    return true;
+}
+
+void pacer_deinit(void)
+{
+    SDL_DestroyMutex(stats_lock);
+    stats_lock = NULL;
+}
+
+void pacer_set_speed(int _speed)
+{
+    speed = _speed;
+    grid_origin = now_ns();
+    grid_frame = 0;
+}
+
+uint64_t pacer_frame_ns(void)
+{
+    return speed == 0 ? 0 : grid_offset(1);
+}
+
+void pacer_begin_frame(void)
+{
+    frame_begin = now_ns();
+}
+
+void pacer_end_frame(void)
+{
+    uint64_t end = now_ns();
+    uint64_t emulation = end - frame_begin;
+
+    if (speed == 0) {
+        behind = false;
+        SDL_LockMutex(stats_lock);
+        stats.frames++;
+        stats.lateness_ns = 0;
+        hist_add(&stats.emulation, emulation);
+        SDL_UnlockMutex(stats_lock);
+        return;
+    }
+
+    uint64_t deadline = grid_origin + grid_offset(++grid_frame);
+    int64_t lateness = (int64_t)(end - deadline);
+    behind = lateness > 0;
+    uint64_t skipped = 0;
+    bool reset = false;
+    if (lateness >= (int64_t)grid_offset(1)) {
+        switch (policy) {
+            case PACE_CATCH_UP:
+                break;
+            case PACE_SKIP:
+                while (grid_origin + grid_offset(grid_frame + 1) <= end) {
+                    grid_frame++;
+                    skipped++;
+                }
+                break;
+            case PACE_RESET:
+                grid_origin = end;
+                grid_frame = 0;
+                reset = true;
+                break;
+        }
+    }
+
+    uint64_t overshoot = 0;
+    bool slept = lateness < 0;
+    if (slept) {
+        sleep_until(deadline);
+        overshoot = now_ns() - deadline;
+    }
+
+    SDL_LockMutex(stats_lock);
+    stats.frames++;
+    stats.lateness_ns = lateness;
+    if (lateness > 0)
+        stats.missed++;
+    stats.skipped += skipped;
+    if (reset)
+        stats.resets++;
+    hist_add(&stats.emulation, emulation);
+    if (slept)
+        hist_add(&stats.overshoot, overshoot);
+    SDL_UnlockMutex(stats_lock);
+}
+
+bool pacer_is_behind(void)
+{
+    return behind;
+}
+
+void pacer_record_present(uint64_t ns)
+{
+    SDL_LockMutex(stats_lock);
+    hist_add(&stats.present, ns);
+    SDL_UnlockMutex(stats_lock);
+}
+
+pace_stats pacer_get_stats(void)
+{
+    SDL_LockMutex(stats_lock);
+    pace_stats copy = stats;
+    SDL_UnlockMutex(stats_lock);
+    return copy;
+}
+
+/* Upper bound of the bucket holding the p-th quantile (0 to 1). */
+uint64_t pace_hist_percentile(const pace_histogram *hist, double p)
+{
+    if (hist->total == 0)
+        return 0;
+    uint64_t rank = (uint64_t)(p * (double)(hist->total - 1));
+    uint64_t seen = 0;
+    for (int i = 0; i < PACE_HIST_BUCKETS; i++) {
+        seen += hist->counts[i];
+        if (seen > rank)
+            return SDL_min(1000ull << i, hist->max_ns);
+    }
+    return hist->max_ns;
+}
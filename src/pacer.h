@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* What to do once emulation has fallen a whole frame or more behind its
+   deadlines. */
+typedef enum {
+    PACE_CATCH_UP, /* Run the missed frames back to back. */
+    PACE_SKIP,     /* Drop the missed frames, keeping the deadline grid. */
+    PACE_RESET     /* Start a new deadline grid from now. */
+} pace_policy;
+
+/* Bucket 0 counts durations under 1 us, bucket i those in [2^(i-1), 2^i) us. */
+#define PACE_HIST_BUCKETS 24
+typedef struct {
+    uint64_t counts[PACE_HIST_BUCKETS];
+    uint64_t total;
+    uint64_t sum_ns;
+    uint64_t max_ns;
+} pace_histogram;
+
+typedef struct {
+    uint64_t frames;
+    uint64_t missed;   /* Frames finished after their deadline. */
+    uint64_t skipped;  /* Deadlines dropped by PACE_SKIP. */
+    uint64_t resets;   /* Grids restarted by PACE_RESET. */
+    int64_t lateness_ns; /* Of the last frame; negative when early. */
+    pace_histogram emulation;
+    pace_histogram overshoot; /* Wake-up time past the deadline. */
+    pace_histogram present;
+} pace_stats;
+
+bool pacer_init(pace_policy policy);
+void pacer_deinit(void);
+/* Multiple of the DMG frame rate to pace to, 0 for none. Restarts the grid. */
+void pacer_set_speed(int speed);
+/* Host time one frame is paced to take, 0 when unpaced. */
+uint64_t pacer_frame_ns(void);
+
+/* Called by the emulation thread around each frame. end_frame sleeps until
+   the frame's deadline, applying the policy when behind. */
+void pacer_begin_frame(void);
+void pacer_end_frame(void);
+/* Whether the last frame finished after its deadline. */
+bool pacer_is_behind(void);
+/* Called by the window thread. */
+void pacer_record_present(uint64_t ns);
+
+pace_stats pacer_get_stats(void);
+uint64_t pace_hist_percentile(const pace_histogram *hist, double p);
@@ -2,6 +2,7 @@
 #include "bus.h"
 #include "system.h"
 #include "interrupt.h"
+#include "dma.h"
 #include <string.h>
 
 #include <stdio.h>
@@ -13,30 +14,40 @@ static byte vram[VRAM_SIZE];
 /* Object Attribute Memory. */
 static byte oam[OAM_SIZE];
 
-static byte lcdc_reg;
-static inline bit lcd_enable(void) {
-    return get_bit(lcdc_reg, 7);
+/* Registers read by the pixel pipeline. */
+typedef struct {
+    byte lcdc;
+    byte scy, scx;
+    byte ly;
+    byte bgp;
+    byte obp0, obp1;
+    byte wy, wx;
+} ppu_regs;
+static ppu_regs regs;
+
+static inline bit lcd_enable(const ppu_regs *r) {
+    return get_bit(r->lcdc, 7);
 }
-static inline bit win_map_area(void) {
-    return get_bit(lcdc_reg, 6);
+static inline bit win_map_area(const ppu_regs *r) {
+    return get_bit(r->lcdc, 6);
 }
-static inline bit win_enable(void) {
-    return get_bit(lcdc_reg, 5);
+static inline bit win_enable(const ppu_regs *r) {
+    return get_bit(r->lcdc, 5);
 }
-static inline bit bg_win_data_area(void) {
-    return get_bit(lcdc_reg, 4);
+static inline bit bg_win_data_area(const ppu_regs *r) {
+    return get_bit(r->lcdc, 4);
 }
-static inline bit bg_map_area(void) {
-    return get_bit(lcdc_reg, 3);
+static inline bit bg_map_area(const ppu_regs *r) {
+    return get_bit(r->lcdc, 3);
 }
-static inline bit obj_size(void) {
-    return get_bit(lcdc_reg, 2);
+static inline bit obj_size(const ppu_regs *r) {
+    return get_bit(r->lcdc, 2);
 }
-static inline bit obj_enable(void) {
-    return get_bit(lcdc_reg, 1);
+static inline bit obj_enable(const ppu_regs *r) {
+    return get_bit(r->lcdc, 1);
 }
-static inline bit bg_win_enable(void) {
-    return get_bit(lcdc_reg, 0);
+static inline bit bg_win_enable(const ppu_regs *r) {
+    return get_bit(r->lcdc, 0);
 }
 bool just_enabled = false;
 
@@ -57,26 +68,60 @@ static inline bit mode0_int_select(void) {
 static bit prev_stat_int_signal = 0;
 static bit prev_vblank_int_signal = 0;
 
-static byte scy_reg, scx_reg;
-static byte ly_reg, lyc_reg;
+static byte lyc_reg;
 
-static byte bgp_reg;
-static byte obp0_reg, obp1_reg;
 static inline int get_palette_color(byte palette, int idx) {
     return get_bits(palette, (idx * 2) + 1, (idx * 2));
 }
 
-static byte wy_reg, wx_reg;
-
-static uint8_t frame_buffer[GB_HEIGHT * GB_WIDTH];
-static uint8_t front_buffer[GB_HEIGHT * GB_WIDTH];
-static uint8_t off_buffer[GB_HEIGHT * GB_WIDTH];
-static SDL_Mutex *frame_mux;
-static inline void commit_frame(void) {
-    SDL_LockMutex(frame_mux);
-    memcpy(front_buffer, frame_buffer, sizeof(front_buffer));
-    SDL_UnlockMutex(frame_mux);
-}
+/* Output pixels are looked up from the palette register value and color index,
+   so that the frame is produced directly in the consumer's format. */
+static const ppu_colors palettes[PPU_NUM_PALETTES] = {
+    /* Black and white. */
+    { 0xE0E0E0, 0xB0B0B0, 0x707070, 0x303030, 0xF0F0F0 },
+    /* Olive. */
+    { 0x9CA142, 0x4C722B, 0x0C440C, 0x1F2F0F, 0xAAAF48 }
+};
+static ppu_format out_format;
+static int out_bpp;
+static uint32_t out_lut[256][4];
+static uint32_t out_off_pixel;
+static int lut_palette;
+static SDL_AtomicInt selected_palette;
+static void build_out_lut(void);
+
+/* Lock-free triple buffer between the PPU and the frame consumer.
+   The PPU owns back_slot and the consumer owns front_slot. The remaining slot
+   is handed over through ready_slot, which also carries FRAME_FRESH when it
+   holds a frame the consumer has not yet picked up. Slots are swapped, never
+   copied. */
+#define NUM_FRAME_SLOTS 3
+#define FRAME_FRESH 0x4
+static uint32_t frame_slots[NUM_FRAME_SLOTS][GB_HEIGHT * GB_WIDTH];
+static int back_slot, front_slot;
+static SDL_AtomicInt ready_slot;
+static void *frame_buffer;
+static void fill_frame(void *buf, uint32_t px);
+static inline void put_pixel(int idx, uint32_t px);
+
+static void (*frame_ready_fn)(void);
+static void (*frame_tap_fn)(const void *frame);
+/* Updated by the producer and the consumer. Created once. */
+static SDL_Mutex *stats_lock;
+static ppu_frame_stats stats;
+
+/* Per-slot frame metadata, written by the producer before publishing. */
+static uint32_t slot_seq[NUM_FRAME_SLOTS];
+static bool slot_dirty[NUM_FRAME_SLOTS][GB_HEIGHT];
+static uint64_t slot_line_hash[NUM_FRAME_SLOTS][GB_HEIGHT];
+static uint32_t frame_seq;
+static int last_slot;
+/* Consumer only. */
+static uint32_t front_seq;
+static bool front_dirty[GB_HEIGHT];
+
+static void commit_frame(bool blank);
+static void commit_off_frame(void);
 
 static ppu_mode mode;
 static void set_mode(ppu_mode _mode);
@@ -85,30 +130,18 @@ static void set_mode(ppu_mode _mode);
 #define SCANLINES_PER_FRAME 154
 #define MODE2_OAM_T_CYCLES 80
 static int scanline_counter;
-static bool mode3_draw_complete;
-/* Internal register. */
-static byte lx_reg;
 
-static void mode0_dot(void);
-static void mode1_dot(void);
-static void mode2_dot(void);
-static void mode3_dot(void);
+/* */
 
 typedef struct {
     uint16_t addr;
     byte obj_x;
     byte obj_y;
 } obj_slot_type;
-static obj_slot_type scanline_objs[10];
-static int scanline_objs_count;
-static uint16_t mode2_addr;
 typedef enum {
     CHECK,
     PUSH, SKIP
 } mode2_cycle_type;
-static mode2_cycle_type mode2_cycle;
-
-/* */
 
 typedef struct {
     int palette_idx;
@@ -122,14 +155,6 @@ typedef struct {
     int head;
 } fifo;
 
-static fifo bg_fifo;
-static fifo obj_fifo;
-static void fifo_clear(fifo *f);
-static bool fifo_pop(fifo *f, pixel *p);
-static bool bg_fifo_fill(pixel *p);
-
-/* */
-
 typedef struct {
     int dot;
 
@@ -140,52 +165,294 @@ typedef struct {
     pixel pixels[8];
 } fetcher;
 
-static byte bg_fetch_x;
-static uint16_t bg_id_addr;
-static int scx_disregard;
-static bool wy_check;
-static bool window_mode;
-static byte win_x, win_y;
-static fetcher bg_fetcher;
-static void check_win_lx(void);
-
-bool need_to_fetch_obj;
-static obj_slot_type fetch_obj;
-static byte obj_fetch_attribs;
-static fetcher obj_fetcher;
-static void check_objs_lx(void);
+/* Copy of the memory and registers seen by the PPU, kept up to date by the
+   render worker from the event stream. */
+typedef struct {
+    byte vram[VRAM_SIZE];
+    byte oam[OAM_SIZE];
+    ppu_regs regs;
+
+    bool dma_blocks_oam;
+    bool dma_blocks_vram;
+    byte dma_val;
+} ppu_mirror;
+
+/* Mode 2 and mode 3 state of one scanline. The emulation thread always runs
+   one (live), which determines timing. With the render worker enabled it runs
+   without producing pixels, and the worker replays each line on its own pipe
+   from the mirrored state. */
+typedef struct {
+    ppu_regs *r;
+    /* NULL: read through the bus. */
+    ppu_mirror *mem;
+    bool render;
+
+    obj_slot_type scanline_objs[10];
+    int scanline_objs_count;
+    uint16_t mode2_addr;
+    mode2_cycle_type mode2_cycle;
+    /* Mode 2 takes the line's bucket instead of scanning OAM dot by dot, until
+       something disturbs the scan. */
+    bool scan_from_bucket;
+    /* scanline_objs indices sorted by X, and the next one to trigger a fetch. */
+    byte obj_order[10];
+    int obj_next;
+
+    /* Internal register. */
+    byte lx_reg;
+    bool mode3_draw_complete;
+
+    fifo bg_fifo;
+    fifo obj_fifo;
+
+    byte bg_fetch_x;
+    uint16_t bg_id_addr;
+    int scx_disregard;
+    bool wy_check;
+    bool window_mode;
+    byte win_x, win_y;
+    fetcher bg_fetcher;
+
+    bool need_to_fetch_obj;
+    obj_slot_type fetch_obj;
+    byte obj_fetch_attribs;
+    fetcher obj_fetcher;
+} ppu_pipe;
+static ppu_pipe live;
+
+/* Frames can be run without generating pixels or publishing them, e.g. for
+   run-ahead. */
+static bool output_render = true;
+static bool output_publish = true;
+/* Frameskip: a requested skip applies to the next frame to begin, which then
+   generates no pixels and is not published. Timing is unaffected. */
+static bool skip_requested = false;
+static bool skipping_frame = false;
+static inline bool frame_rendered(void)
+{
+    return output_render && !skipping_frame;
+}
+static void begin_frame_output(void);
+
+/* Objects selected by the mode 2 scan of each line, in OAM order, given the
+   current OAM and object size. Rebuilt before the next scan after either
+   changes. */
+typedef struct {
+    obj_slot_type objs[10];
+    byte order[10];
+    int count;
+} obj_bucket;
+static obj_bucket obj_buckets[GB_HEIGHT];
+static bool obj_buckets_stale;
+static void rebuild_obj_buckets(void);
+static void sort_objs_by_x(const obj_slot_type *objs, int count, byte *order);
+static void scan_catch_up(ppu_pipe *p);
+static void objs_changing(void);
+
+/* Incremental rendering -- lines whose inputs hash the same as the copy already
+   in a frame slot are only timed, not rendered. */
+static bool incremental;
+static uint32_t tile_version[384];
+static uint32_t map_row_version[64];
+static bool line_skipped;
+static bool line_spoiled;
+/* Mode 3 start state and mid-line writes, to replay a skipped line whose
+   inputs changed after all. */
+static ppu_pipe replay_pipe;
+static ppu_regs replay_regs;
+typedef struct {
+    uint16_t dot;
+    uint16_t addr;
+    byte val;
+} reg_write;
+static reg_write line_writes[T_CYCLES_PER_SCANLINE / T_M_RATIO];
+static int line_writes_count;
+static void begin_line_render(void);
+static void end_line_render(void);
+static void reg_written(uint16_t addr, byte val);
+
+static void regs_apply(ppu_regs *r, uint16_t addr, byte val);
+static void pipe_begin_mode2(ppu_pipe *p);
+static void pipe_begin_mode3(ppu_pipe *p);
+static void mode0_dot(void);
+static void mode1_dot(void);
+static void mode2_dot(ppu_pipe *p);
+static void mode3_dot(ppu_pipe *p);
+
+static void fifo_clear(fifo *f);
+static bool fifo_pop(fifo *f, pixel *p);
+static bool bg_fifo_fill(ppu_pipe *p, pixel *px);
+static bool obj_fifo_fill(ppu_pipe *p, pixel *px);
+
+static void check_win_lx(ppu_pipe *p);
+static void check_objs_lx(ppu_pipe *p);
 
 static void fetcher_clear(fetcher *f);
-static void bg_fetcher_dot(void);
-static void obj_fetcher_dot(void);
+static void bg_fetcher_dot(ppu_pipe *p);
+static void obj_fetcher_dot(ppu_pipe *p);
 
-bool ppu_init(SDL_Mutex *_frame_mux)
+/* */
+
+typedef enum {
+    EV_VRAM,
+    EV_OAM,
+    EV_OAM_DMA,
+    EV_REG,
+    EV_DMA_BLOCK,
+    EV_LINE,
+    EV_LINE_END,
+    EV_FRAME,
+    EV_LCD_OFF,
+    EV_QUIT
+} event_kind;
+typedef struct {
+    uint16_t dot;
+    uint8_t kind;
+    uint8_t val;
+    uint16_t addr;
+    uint16_t arg;
+} pipe_event;
+
+/* Single-producer, single-consumer ring from the emulation thread to the
+   render worker. Indices run freely and are masked on access. */
+#define EVENT_RING_SIZE (1 << 16)
+#define EVENT_RING_MASK (EVENT_RING_SIZE - 1)
+static pipe_event event_ring[EVENT_RING_SIZE];
+static SDL_AtomicInt ring_head;
+static SDL_AtomicInt ring_tail;
+/* Producer only. */
+static unsigned int ring_tail_pending;
+static unsigned int ring_head_cached;
+static int emitted_dma_block;
+
+static SDL_AtomicInt worker_waiting;
+static SDL_AtomicInt producer_waiting;
+static SDL_Semaphore *ring_data;
+static SDL_Semaphore *ring_space;
+
+static SDL_Thread *render_worker;
+static ppu_mirror mirror;
+static ppu_pipe worker_pipe;
+static int loop_render(void *data);
+
+static inline bool use_worker(void) {
+    return render_worker != NULL;
+}
+static void emit(event_kind kind, uint16_t addr, byte val, uint16_t arg);
+static void ring_publish(void);
+static void emit_dma_block(void);
+
+bool ppu_init(ppu_format format, bool threaded, bool _incremental)
 {
+    live.r = &regs;
+    live.mem = NULL;
+    live.render = !threaded;
+    output_render = true;
+    output_publish = true;
+    skip_requested = false;
+    skipping_frame = false;
+    /* The render worker always renders whole frames. */
+    incremental = _incremental && !threaded;
+    line_skipped = false;
+    obj_buckets_stale = true;
+
     /* DMG boot handoff state. */
-    lcdc_reg = 0x91;
+    regs.lcdc = 0x91;
     stat_reg = 0x85; /* Implies Mode 1 : Vertical blank. */
     /* Note that the mode is changed to Mode 2: OAM scan to begin a new frame. */
     set_mode(MODE2_OAM);
-    scy_reg = 0x00, scx_reg = 0x00;
-    ly_reg = 0x00, lyc_reg = 0x00;
-    bgp_reg = 0x00;
-    obp0_reg = 0xFF, obp1_reg = 0xFF;
-    wy_reg = 0x00, wx_reg = 0x00;
+    regs.scy = 0x00, regs.scx = 0x00;
+    regs.ly = 0x00, lyc_reg = 0x00;
+    regs.bgp = 0x00;
+    regs.obp0 = 0xFF, regs.obp1 = 0xFF;
+    regs.wy = 0x00, regs.wx = 0x00;
 
     scanline_counter = 0;
-    for (int i = 0; i < GB_WIDTH * GB_HEIGHT; i++)
-        off_buffer[i] = 4;
 
-    frame_mux = _frame_mux;
+    out_format = format;
+    switch (out_format) {
+        case PPU_FORMAT_INDEX8:   out_bpp = 1; break;
+        case PPU_FORMAT_RGB565:   out_bpp = 2; break;
+        case PPU_FORMAT_RGBA8888: out_bpp = 4; break;
+    }
+    lut_palette = 0;
+    SDL_SetAtomicInt(&selected_palette, lut_palette);
+    build_out_lut();
+
+    back_slot = 0;
+    SDL_SetAtomicInt(&ready_slot, 1);
+    front_slot = 2;
+    frame_buffer = frame_slots[back_slot];
+    if (stats_lock == NULL && (stats_lock = SDL_CreateMutex()) == NULL)
+        return false;
+    SDL_LockMutex(stats_lock);
+    stats = (ppu_frame_stats){ 0 };
+    SDL_UnlockMutex(stats_lock);
+    for (int i = 0; i < NUM_FRAME_SLOTS; i++)
+        fill_frame(frame_slots[i], out_off_pixel);
+    memset(slot_line_hash, 0, sizeof(slot_line_hash));
+    frame_seq = 0;
+    front_seq = 0;
+    last_slot = -1;
+
+    if (threaded) {
+        SDL_SetAtomicInt(&ring_head, 0);
+        SDL_SetAtomicInt(&ring_tail, 0);
+        ring_tail_pending = 0;
+        ring_head_cached = 0;
+        emitted_dma_block = 0;
+        SDL_SetAtomicInt(&worker_waiting, 0);
+        SDL_SetAtomicInt(&producer_waiting, 0);
+        ring_data = SDL_CreateSemaphore(0);
+        ring_space = SDL_CreateSemaphore(0);
+        if (ring_data == NULL || ring_space == NULL)
+            return false;
+
+        /* The worker starts from the current state and follows the events
+           emitted from here on. */
+        memcpy(mirror.vram, vram, sizeof(vram));
+        memcpy(mirror.oam, oam, sizeof(oam));
+        mirror.regs = regs;
+        mirror.dma_blocks_oam = false;
+        mirror.dma_blocks_vram = false;
+        mirror.dma_val = 0xFF;
+        worker_pipe = live;
+        worker_pipe.r = &mirror.regs;
+        worker_pipe.mem = &mirror;
+        worker_pipe.render = true;
+
+        render_worker = SDL_CreateThread(&loop_render, "MyDMG render", NULL);
+        if (render_worker == NULL)
+            return false;
+        emit(EV_LINE, 0, regs.ly, live.win_y);
+    }
 
     return true;
 }
 
+void ppu_deinit(void)
+{
+    if (!use_worker())
+        return;
+
+    emit(EV_QUIT, 0, 0, 0);
+    ring_publish();
+    SDL_WaitThread(render_worker, NULL);
+    render_worker = NULL;
+    SDL_DestroySemaphore(ring_data);
+    SDL_DestroySemaphore(ring_space);
+}
+
 void ppu_tick(void)
 {
     if (mode == LCD_DISABLED)
         return;
 
+    if (use_worker())
+        emit_dma_block();
+    if (line_skipped && mode == MODE3_DRAW && dma_is_active())
+        line_spoiled = true;
+
     /* Pixel FIFO steps by T-cycle. */
     for (int _ = 0; _ < T_M_RATIO; _++) {
         switch (mode) {
@@ -196,27 +463,45 @@ void ppu_tick(void)
                 mode1_dot();
                 break;
             case MODE2_OAM:
-                mode2_dot();
+                mode2_dot(&live);
                 break;
             case MODE3_DRAW:
-                mode3_dot();
+                mode3_dot(&live);
                 break;
         }
 
         if (++scanline_counter == T_CYCLES_PER_SCANLINE) {
             /* Begin new scanline. */
             scanline_counter = 0;
-            if (window_mode)
-                win_y++;
-            if (++ly_reg == SCANLINES_PER_FRAME) {
+            if (live.window_mode)
+                live.win_y++;
+            if (++regs.ly == SCANLINES_PER_FRAME) {
                 /* Begin new frame. */
                 just_enabled = false;
-                ly_reg = 0;
-                win_y = 0;
+                regs.ly = 0;
+                live.win_y = 0;
+                begin_frame_output();
             }
-            
-            if (ly_reg >= GB_HEIGHT) {
-                commit_frame();
+
+            if (regs.ly >= GB_HEIGHT) {
+                if (regs.ly == GB_HEIGHT) {
+                    if (use_worker()) {
+                        emit(EV_FRAME, 0, just_enabled, 0);
+                        ring_publish();
+                    }
+                    else if (output_publish) {
+                        /* Run-ahead frames are neither counted nor tapped. */
+                        if (skipping_frame) {
+                            SDL_LockMutex(stats_lock);
+                            stats.skipped++;
+                            SDL_UnlockMutex(stats_lock);
+                            if (frame_tap_fn != NULL)
+                                frame_tap_fn(NULL);
+                        }
+                        else
+                            commit_frame(just_enabled);
+                    }
+                }
                 set_mode(MODE1_VBLANK);
             }
             else
@@ -224,7 +509,7 @@ void ppu_tick(void)
         }
         else if (mode == MODE2_OAM && scanline_counter == MODE2_OAM_T_CYCLES)
             set_mode(MODE3_DRAW);
-        else if (mode == MODE3_DRAW && mode3_draw_complete)
+        else if (mode == MODE3_DRAW && live.mode3_draw_complete)
             set_mode(MODE0_HBLANK);
     }
 
@@ -233,10 +518,10 @@ void ppu_tick(void)
        Note that LY will only change on an M-cycle boundary -- the number of
        dots to render one scanline is a multiple of the T:M ratio, i.e.
        divisible by 4. */
-    
+
     bit next_stat_int_signal = 0;
 
-    if (ly_reg == lyc_reg) {
+    if (regs.ly == lyc_reg) {
         stat_reg = set_bit(stat_reg, 2, 1);
         if (lyc_int_select() == 1)
             next_stat_int_signal = 1;
@@ -267,26 +552,27 @@ void ppu_tick(void)
 
 static void set_mode(ppu_mode _mode) {
     mode = _mode;
-    
+
     switch (mode) {
         case MODE0_HBLANK:
+            if (incremental)
+                end_line_render();
+            if (use_worker()) {
+                emit(EV_LINE_END, 0, 0, 0);
+                ring_publish();
+            }
             break;
         case MODE1_VBLANK:
             break;
         case MODE2_OAM:
-            scanline_objs_count = 0;
-            mode2_addr = OAM_START;
-            mode2_cycle = CHECK;
-            wy_check = ly_reg >= wy_reg;
+            if (use_worker())
+                emit(EV_LINE, 0, regs.ly, live.win_y);
+            pipe_begin_mode2(&live);
             break;
         case MODE3_DRAW:
-            lx_reg = 0xF8; bg_fetch_x = 0xF8;
-            fifo_clear(&bg_fifo); fetcher_clear(&bg_fetcher);
-            fifo_clear(&obj_fifo); fetcher_clear(&obj_fetcher);
-            window_mode = false; win_x = 0; check_win_lx();
-            scx_disregard = scx_reg % 8;
-            check_objs_lx();
-            mode3_draw_complete = false;
+            pipe_begin_mode3(&live);
+            if (incremental)
+                begin_line_render();
             break;
         case LCD_DISABLED:
             stat_reg &= 0xFC;
@@ -296,29 +582,426 @@ static void set_mode(ppu_mode _mode) {
     stat_reg = overlay_masked(stat_reg, mode, 0x03);
 }
 
+static void regs_apply(ppu_regs *r, uint16_t addr, byte val)
+{
+    switch (addr) {
+        case LCDC_REG: r->lcdc = val; break;
+        case SCY_REG:  r->scy  = val; break;
+        case SCX_REG:  r->scx  = val; break;
+        case BGP_REG:  r->bgp  = val; break;
+        case OBP0_REG: r->obp0 = val; break;
+        case OBP1_REG: r->obp1 = val; break;
+        case WY_REG:   r->wy   = val; break;
+        case WX_REG:   r->wx   = val; break;
+    }
+}
+
+static void pipe_begin_mode2(ppu_pipe *p)
+{
+    p->scanline_objs_count = 0;
+    p->mode2_addr = OAM_START;
+    p->mode2_cycle = CHECK;
+    p->wy_check = p->r->ly >= p->r->wy;
+
+    /* The scan reads 0xFF during OAM DMA, so it has to be done dot by dot. */
+    p->scan_from_bucket = p->mem == NULL && !dma_is_active();
+    if (p->scan_from_bucket && obj_buckets_stale)
+        rebuild_obj_buckets();
+}
+
+static void pipe_begin_mode3(ppu_pipe *p)
+{
+    if (p->scan_from_bucket) {
+        const obj_bucket *b = &obj_buckets[p->r->ly];
+        memcpy(p->scanline_objs, b->objs, sizeof(b->objs));
+        memcpy(p->obj_order, b->order, sizeof(b->order));
+        p->scanline_objs_count = b->count;
+        p->scan_from_bucket = false;
+    }
+    else
+        sort_objs_by_x(p->scanline_objs, p->scanline_objs_count, p->obj_order);
+    p->obj_next = 0;
+
+    p->lx_reg = 0xF8; p->bg_fetch_x = 0xF8;
+    fifo_clear(&p->bg_fifo); fetcher_clear(&p->bg_fetcher);
+    fifo_clear(&p->obj_fifo); fetcher_clear(&p->obj_fetcher);
+    p->window_mode = false; p->win_x = 0; check_win_lx(p);
+    p->scx_disregard = p->r->scx % 8;
+    check_objs_lx(p);
+    p->mode3_draw_complete = false;
+}
+
 byte vram_read(uint16_t addr) {
     return vram[addr - VRAM_START];
 }
 void vram_write(uint16_t addr, byte val) {
     vram[addr - VRAM_START] = val;
+    if (addr < 0x9800)
+        tile_version[(addr - VRAM_START) >> 4]++;
+    else
+        map_row_version[(addr - 0x9800) >> 5]++;
+    if (use_worker())
+        emit(EV_VRAM, addr, val, 0);
 }
 
 byte oam_read(uint16_t addr) {
     return oam[addr - OAM_START];
 }
 void oam_write(uint16_t addr, byte val) {
+    objs_changing();
     oam[addr - OAM_START] = val;
+    if (use_worker())
+        emit(EV_OAM, addr, val, 0);
+}
+void oam_dma_write(uint16_t addr, byte val) {
+    objs_changing();
+    oam[addr - OAM_START] = val;
+    if (use_worker())
+        emit(EV_OAM_DMA, addr, val, 0);
+}
+
+/* Does not cover the render worker, whose mirror would have to be resent. */
+void ppu_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, vram);
+    SNAPSHOT(s, oam);
+    SNAPSHOT(s, regs);
+    SNAPSHOT(s, just_enabled);
+    SNAPSHOT(s, stat_reg);
+    SNAPSHOT(s, prev_stat_int_signal);
+    SNAPSHOT(s, prev_vblank_int_signal);
+    SNAPSHOT(s, lyc_reg);
+    SNAPSHOT(s, mode);
+    SNAPSHOT(s, scanline_counter);
+    SNAPSHOT(s, live);
+
+    if (s->pass == SNAPSHOT_LOAD) {
+        live.render = frame_rendered() && !use_worker();
+        /* The live scan may be reading from them. */
+        rebuild_obj_buckets();
+        line_skipped = false;
+        /* VRAM changed without bumping the versions. */
+        memset(slot_line_hash, 0, sizeof(slot_line_hash));
+        last_slot = -1;
+    }
+}
+
+void ppu_set_output(bool render, bool publish)
+{
+    output_render = render;
+    output_publish = publish;
+    if (!use_worker())
+        live.render = frame_rendered();
+}
+
+/* Not supported by the render worker, which always renders whole frames. */
+void ppu_request_frame_skip(bool skip)
+{
+    skip_requested = skip && !use_worker();
+}
+
+static void begin_frame_output(void)
+{
+    skipping_frame = skip_requested;
+    if (!use_worker())
+        live.render = frame_rendered();
 }
 
 ppu_mode ppu_get_mode() {
     return mode;
 }
-uint8_t *ppu_get_frame_buffer() {
+
+/* Called by the frame producer (the PPU, or the render worker) at the start of
+   VBlank. */
+static void commit_frame(bool blank)
+{
     /* "When re-enabling the LCD, the PPU will immediately start drawing again,
        but the screen will stay blank during the first frame." "*/
-    if (mode == LCD_DISABLED || just_enabled)
-        return off_buffer;
-    return front_buffer;
+    if (blank) {
+        fill_frame(frame_buffer, out_off_pixel);
+        memset(slot_line_hash[back_slot], 0, sizeof(slot_line_hash[back_slot]));
+    }
+    if (!incremental || blank || last_slot == -1) {
+        memset(slot_dirty[back_slot], true, sizeof(slot_dirty[back_slot]));
+        if (!incremental)
+            memset(slot_line_hash[back_slot], 0, sizeof(slot_line_hash[back_slot]));
+    }
+    if (frame_tap_fn != NULL)
+        frame_tap_fn(frame_buffer);
+    slot_seq[back_slot] = ++frame_seq;
+    last_slot = back_slot;
+
+    int prev = SDL_SetAtomicInt(&ready_slot, back_slot | FRAME_FRESH);
+    SDL_LockMutex(stats_lock);
+    if (prev & FRAME_FRESH)
+        stats.dropped++;
+    stats.published++;
+    SDL_UnlockMutex(stats_lock);
+
+    back_slot = prev & ~FRAME_FRESH;
+    frame_buffer = frame_slots[back_slot];
+    if (frame_ready_fn != NULL)
+        frame_ready_fn();
+
+    /* Palette changes take effect on frame boundaries. */
+    int palette = SDL_GetAtomicInt(&selected_palette);
+    if (palette != lut_palette) {
+        lut_palette = palette;
+        build_out_lut();
+    }
+}
+
+/* Called by the frame producer when the LCD is switched off. */
+static void commit_off_frame(void)
+{
+    commit_frame(true);
+}
+
+void ppu_set_frame_ready_callback(void (*fn)(void)) {
+    frame_ready_fn = fn;
+}
+void ppu_set_frame_tap(void (*fn)(const void *frame)) {
+    frame_tap_fn = fn;
+}
+
+/* Called by the (single) frame consumer. The returned frame stays valid and
+   unchanged until the next call. */
+const void *ppu_acquire_frame(bool *is_new)
+{
+    bool fresh = (SDL_GetAtomicInt(&ready_slot) & FRAME_FRESH) != 0;
+    if (fresh) {
+        int prev = SDL_SetAtomicInt(&ready_slot, front_slot);
+        front_slot = prev & ~FRAME_FRESH;
+
+        /* Dirty lines are relative to the previous frame, so any frame in
+           between that was dropped makes every line dirty. */
+        bool consecutive = slot_seq[front_slot] == front_seq + 1;
+        for (int i = 0; i < GB_HEIGHT; i++)
+            front_dirty[i] = !consecutive || slot_dirty[front_slot][i];
+        front_seq = slot_seq[front_slot];
+    }
+    else {
+        SDL_LockMutex(stats_lock);
+        stats.duplicated++;
+        SDL_UnlockMutex(stats_lock);
+        memset(front_dirty, false, sizeof(front_dirty));
+    }
+
+    if (is_new != NULL)
+        *is_new = fresh;
+    return frame_slots[front_slot];
+}
+
+/* Which lines of the last acquired frame differ from the frame acquired before
+   it. */
+const bool *ppu_get_dirty_lines(void) {
+    return front_dirty;
+}
+
+int ppu_get_frame_pitch(void) {
+    return GB_WIDTH * out_bpp;
+}
+
+const uint32_t *ppu_get_palette_colors(int idx) {
+    return palettes[idx];
+}
+void ppu_select_palette(int idx) {
+    SDL_SetAtomicInt(&selected_palette, idx);
+}
+
+static uint32_t host_pixel(uint32_t rgb)
+{
+    byte r = (rgb >> 16) & 0xFF;
+    byte g = (rgb >>  8) & 0xFF;
+    byte b = (rgb >>  0) & 0xFF;
+    switch (out_format) {
+        case PPU_FORMAT_RGBA8888:
+            return ((uint32_t)r << 24) | ((uint32_t)g << 16) | ((uint32_t)b << 8) | 0xFF;
+        case PPU_FORMAT_RGB565:
+            return ((uint32_t)(r >> 3) << 11) | ((uint32_t)(g >> 2) << 5) | (b >> 3);
+        default:
+            return 0;
+    }
+}
+
+static void build_out_lut(void)
+{
+    const uint32_t *colors = palettes[lut_palette];
+    for (int val = 0; val < 256; val++) {
+        for (int idx = 0; idx < 4; idx++) {
+            int shade = get_palette_color(val, idx);
+            out_lut[val][idx] = (out_format == PPU_FORMAT_INDEX8) ?
+                (uint32_t)shade : host_pixel(colors[shade]);
+        }
+    }
+    out_off_pixel = (out_format == PPU_FORMAT_INDEX8) ?
+        PPU_OFF_COLOR : host_pixel(colors[PPU_OFF_COLOR]);
+}
+
+static void fill_frame(void *buf, uint32_t px)
+{
+    if (out_bpp == 1) {
+        memset(buf, px, GB_WIDTH * GB_HEIGHT);
+        return;
+    }
+    for (int i = 0; i < GB_WIDTH * GB_HEIGHT; i++) {
+        if (out_bpp == 2)
+            ((uint16_t *)buf)[i] = px;
+        else
+            ((uint32_t *)buf)[i] = px;
+    }
+}
+
+static inline void put_pixel(int idx, uint32_t px)
+{
+    switch (out_bpp) {
+        case 1: ((uint8_t  *)frame_buffer)[idx] = px; break;
+        case 2: ((uint16_t *)frame_buffer)[idx] = px; break;
+        case 4: ((uint32_t *)frame_buffer)[idx] = px; break;
+    }
+}
+
+ppu_frame_stats ppu_get_frame_stats(void)
+{
+    SDL_LockMutex(stats_lock);
+    ppu_frame_stats copy = stats;
+    SDL_UnlockMutex(stats_lock);
+    return copy;
+}
+
+static inline byte pipe_read(const ppu_pipe *p, uint16_t addr)
+{
+    if (p->mem == NULL)
+        return bus_read_ppu(addr);
+
+    /* Mirrors bus_read_ppu(). */
+    if (addr >= OAM_START)
+        return p->mem->dma_blocks_oam ? 0xFF : p->mem->oam[addr - OAM_START];
+    return p->mem->dma_blocks_vram ? p->mem->dma_val : p->mem->vram[addr - VRAM_START];
+}
+
+/* */
+
+static inline uint64_t hash_mix(uint64_t h, uint32_t val) {
+    h ^= val;
+    return h * 0x100000001B3ull;
+}
+
+static inline int bg_tile_index(const ppu_regs *r, byte tile_id) {
+    return (bg_win_data_area(r) == 0 && tile_id < 0x80) ? tile_id + 256 : tile_id;
+}
+
+/* Hash of a tile map row and the tile data it references. */
+static uint64_t hash_map_row(uint64_t h, const ppu_regs *r, bit map_area, int row)
+{
+    int map_row = ((int)map_area << 5) | row;
+    h = hash_mix(h, map_row_version[map_row]);
+    const byte *ids = &vram[0x1800 + (map_row << 5)];
+    for (int i = 0; i < 32; i++)
+        h = hash_mix(h, tile_version[bg_tile_index(r, ids[i])]);
+    return h;
+}
+
+/* Hash of everything that determines the pixels of the current line, taken at
+   the start of mode 3. */
+static uint64_t line_hash(void)
+{
+    const ppu_regs *r = &regs;
+    uint64_t h = 0xCBF29CE484222325ull;
+    h = hash_mix(h, (uint32_t)r->lcdc | ((uint32_t)r->scy << 8) |
+        ((uint32_t)r->scx << 16) | ((uint32_t)r->ly << 24));
+    h = hash_mix(h, (uint32_t)r->bgp | ((uint32_t)r->obp0 << 8) |
+        ((uint32_t)r->obp1 << 16) | ((uint32_t)lut_palette << 24));
+    h = hash_mix(h, (uint32_t)r->wy | ((uint32_t)r->wx << 8) |
+        ((uint32_t)live.win_y << 16) | ((uint32_t)live.wy_check << 24));
+
+    h = hash_map_row(h, r, bg_map_area(r), (byte)(r->ly + r->scy) / 8);
+    if (live.wy_check && win_enable(r))
+        h = hash_map_row(h, r, win_map_area(r), live.win_y / 8);
+
+    for (int i = 0; i < live.scanline_objs_count; i++) {
+        const byte *obj = &oam[live.scanline_objs[i].addr - OAM_START];
+        h = hash_mix(h, (uint32_t)obj[0] | ((uint32_t)obj[1] << 8) |
+            ((uint32_t)obj[2] << 16) | ((uint32_t)obj[3] << 24));
+        h = hash_mix(h, tile_version[obj[2] & 0xFE]);
+        h = hash_mix(h, tile_version[obj[2] | 0x01]);
+    }
+
+    /* 0 marks an unknown line. */
+    return h | 1;
+}
+
+static void begin_line_render(void)
+{
+    int ly = regs.ly;
+    if (!frame_rendered()) {
+        slot_line_hash[back_slot][ly] = 0;
+        slot_dirty[back_slot][ly] = true;
+        return;
+    }
+
+    uint64_t h = line_hash();
+    bool dirty = last_slot == -1 || slot_line_hash[last_slot][ly] != h;
+
+    line_skipped = false;
+    line_spoiled = false;
+    if (!dma_is_active()) {
+        if (slot_line_hash[back_slot][ly] == h)
+            line_skipped = true;
+        else if (!dirty) {
+            memcpy((byte *)frame_buffer + ly * GB_WIDTH * out_bpp,
+                (byte *)frame_slots[last_slot] + ly * GB_WIDTH * out_bpp,
+                GB_WIDTH * out_bpp);
+            line_skipped = true;
+        }
+    }
+
+    slot_line_hash[back_slot][ly] = h;
+    slot_dirty[back_slot][ly] = dirty;
+    live.render = !line_skipped;
+    if (line_skipped) {
+        replay_pipe = live;
+        replay_regs = regs;
+        replay_pipe.r = &replay_regs;
+        replay_pipe.render = true;
+        line_writes_count = 0;
+    }
+}
+
+static void end_line_render(void)
+{
+    if (!line_skipped)
+        return;
+
+    live.render = true;
+    line_skipped = false;
+    if (!line_spoiled)
+        return;
+
+    /* Render the line after all. VRAM and OAM cannot have been written by the
+       CPU during mode 3, so only the register writes need replaying. */
+    ppu_pipe *p = &replay_pipe;
+    int next = 0;
+    for (int dot = MODE2_OAM_T_CYCLES;
+         !p->mode3_draw_complete && dot < T_CYCLES_PER_SCANLINE; dot++) {
+        for (; next < line_writes_count && line_writes[next].dot <= dot; next++)
+            regs_apply(p->r, line_writes[next].addr, line_writes[next].val);
+        mode3_dot(p);
+    }
+    slot_line_hash[back_slot][regs.ly] = 0;
+    slot_dirty[back_slot][regs.ly] = true;
+}
+
+static void reg_written(uint16_t addr, byte val)
+{
+    if (use_worker())
+        emit(EV_REG, addr, val, 0);
+    if (line_skipped && mode == MODE3_DRAW) {
+        line_spoiled = true;
+        line_writes[line_writes_count++] = (reg_write){
+            scanline_counter, addr, val
+        };
+    }
 }
 
 static void mode0_dot()
@@ -331,109 +1014,124 @@ static void mode1_dot()
     return;
 }
 
-static void mode2_dot()
+static void mode2_dot(ppu_pipe *p)
 {
-    if (scanline_objs_count == 10)
+    if (p->scan_from_bucket || p->scanline_objs_count == 10)
         return;
-    
-    switch (mode2_cycle) {
+
+    obj_slot_type *slot = &p->scanline_objs[p->scanline_objs_count];
+    switch (p->mode2_cycle) {
         case CHECK:
-            scanline_objs[scanline_objs_count].addr = mode2_addr;
-            byte obj_y = bus_read_ppu(mode2_addr);
-            scanline_objs[scanline_objs_count].obj_y = obj_y;
+            slot->addr = p->mode2_addr;
+            byte obj_y = pipe_read(p, p->mode2_addr);
+            slot->obj_y = obj_y;
             int screen_start = obj_y - 16;
-            int screen_end = screen_start + (obj_size() == 0 ? 8 : 16);
-            bool on_scanline = (ly_reg >= screen_start) && (ly_reg < screen_end);
-            mode2_cycle = on_scanline ? PUSH : SKIP;
+            int screen_end = screen_start + (obj_size(p->r) == 0 ? 8 : 16);
+            bool on_scanline =
+                (p->r->ly >= screen_start) && (p->r->ly < screen_end);
+            p->mode2_cycle = on_scanline ? PUSH : SKIP;
             break;
         case PUSH:
-            scanline_objs[scanline_objs_count].obj_x = bus_read_ppu(mode2_addr + 1);
-            scanline_objs_count++;
+            slot->obj_x = pipe_read(p, p->mode2_addr + 1);
+            p->scanline_objs_count++;
         case SKIP:
-            mode2_addr += 4;
-            mode2_cycle = CHECK;
+            p->mode2_addr += 4;
+            p->mode2_cycle = CHECK;
             break;
     }
 }
 
-static void mode3_dot()
+static void mode3_dot(ppu_pipe *p)
 {
-    if (need_to_fetch_obj)
-        obj_fetcher_dot();
-    bg_fetcher_dot();
+    if (p->need_to_fetch_obj)
+        obj_fetcher_dot(p);
+    bg_fetcher_dot(p);
 
-    if (need_to_fetch_obj)
+    if (p->need_to_fetch_obj)
         return;
 
     pixel bg_pixel;
-    if (fifo_pop(&bg_fifo, &bg_pixel)) {
+    if (fifo_pop(&p->bg_fifo, &bg_pixel)) {
         pixel obj_pixel;
-        bool obj_popped = fifo_pop(&obj_fifo, &obj_pixel);
+        bool obj_popped = fifo_pop(&p->obj_fifo, &obj_pixel);
 
-        if (scx_disregard > 0) {
-            scx_disregard--;
+        if (p->scx_disregard > 0) {
+            p->scx_disregard--;
             return;
         }
 
-        if (!bg_win_enable() || (window_mode && !win_enable()))
-            bg_pixel.palette_idx = 0;
-        if (!obj_enable())
-            obj_pixel.palette_idx = 0;
-
-        /* Default -- Choose BG/WIN pixel if the object FIFO wasn't popped. */
-        int pick = 0;
-        if (obj_popped)
-        {
-            if (!bg_win_enable())
-                pick = 1;
-            else if (!obj_enable())
-                pick = 0;
-            else if (obj_pixel.priority == 1 && bg_pixel.palette_idx != 0)
-                pick = 0;
-            else if (obj_pixel.palette_idx == 0)
-                pick = 0;
-            else
-                pick = 1;
-        }
+        /* Only the number of pixels pushed affects timing. */
+        if (p->render) {
+            const ppu_regs *r = p->r;
+            if (!bg_win_enable(r) || (p->window_mode && !win_enable(r)))
+                bg_pixel.palette_idx = 0;
+            if (!obj_enable(r))
+                obj_pixel.palette_idx = 0;
+
+            /* Default -- Choose BG/WIN pixel if the object FIFO wasn't popped. */
+            int pick = 0;
+            if (obj_popped)
+            {
+                if (!bg_win_enable(r))
+                    pick = 1;
+                else if (!obj_enable(r))
+                    pick = 0;
+                else if (obj_pixel.priority == 1 && bg_pixel.palette_idx != 0)
+                    pick = 0;
+                else if (obj_pixel.palette_idx == 0)
+                    pick = 0;
+                else
+                    pick = 1;
+            }
 
-        int color;
-        if (pick == 0) {
-            color = get_palette_color(bgp_reg, bg_pixel.palette_idx);
-        }
-        else {
-            color = get_palette_color(
-                (obj_pixel.palette == 0 ? obp0_reg : obp1_reg),
-                obj_pixel.palette_idx);
-        }
+            uint32_t px;
+            if (pick == 0) {
+                px = out_lut[r->bgp][bg_pixel.palette_idx];
+            }
+            else {
+                px = out_lut[obj_pixel.palette == 0 ? r->obp0 : r->obp1]
+                    [obj_pixel.palette_idx];
+            }
 
-        if (lx_reg < GB_WIDTH)
-            frame_buffer[ly_reg * GB_WIDTH + lx_reg] = color;
+            if (p->lx_reg < GB_WIDTH)
+                put_pixel(r->ly * GB_WIDTH + p->lx_reg, px);
+        }
 
-        if (++lx_reg == GB_WIDTH) {
+        if (++p->lx_reg == GB_WIDTH) {
             //printf("Mode 3 length = %d\n", scanline_counter - 80 + 1);
-            mode3_draw_complete = true;
+            p->mode3_draw_complete = true;
         }
         else {
-            check_objs_lx();
-            check_win_lx();
+            check_objs_lx(p);
+            check_win_lx(p);
         }
     }
 }
 
 byte ppu_lcdc_read() {
-    return lcdc_reg;
+    return regs.lcdc;
 }
 void ppu_lcdc_write(byte val) {
-    bit prev_lcd_enable = lcd_enable();
-    lcdc_reg = val;
+    bit prev_lcd_enable = lcd_enable(&regs);
+    if (get_bit(regs.lcdc ^ val, 2))
+        objs_changing();
+    regs.lcdc = val;
+    reg_written(LCDC_REG, val);
 
-    if (lcd_enable() == 0 && prev_lcd_enable == 1) {
+    if (lcd_enable(&regs) == 0 && prev_lcd_enable == 1) {
         set_mode(LCD_DISABLED);
+        if (use_worker()) {
+            emit(EV_LCD_OFF, 0, 0, 0);
+            ring_publish();
+        }
+        else if (output_publish)
+            commit_off_frame();
     }
-    else if (lcd_enable() == 1 && prev_lcd_enable == 0) {
+    else if (lcd_enable(&regs) == 1 && prev_lcd_enable == 0) {
         just_enabled = true;
         scanline_counter = 0;
-        ly_reg = 0;
+        regs.ly = 0;
+        begin_frame_output();
         set_mode(MODE2_OAM);
     }
 }
@@ -446,21 +1144,23 @@ void ppu_stat_write(byte val) {
 }
 
 byte ppu_scy_read() {
-    return scy_reg;
+    return regs.scy;
 }
 void ppu_scy_write(byte val) {
-    scy_reg = val;
+    regs.scy = val;
+    reg_written(SCY_REG, val);
 }
 
 byte ppu_scx_read() {
-    return scx_reg;
+    return regs.scx;
 }
 void ppu_scx_write(byte val) {
-    scx_reg = val;
+    regs.scx = val;
+    reg_written(SCX_REG, val);
 }
 
 byte ppu_ly_read() {
-    return ly_reg;
+    return regs.ly;
 }
 void ppu_ly_write(byte val) {
     return;
@@ -474,38 +1174,43 @@ void ppu_lyc_write(byte val) {
 }
 
 byte ppu_bgp_read() {
-    return bgp_reg;
+    return regs.bgp;
 }
 void ppu_bgp_write(byte val) {
-    bgp_reg = val;
+    regs.bgp = val;
+    reg_written(BGP_REG, val);
 }
 
 byte ppu_obp0_read() {
-    return obp0_reg;
+    return regs.obp0;
 }
 void ppu_obp0_write(byte val) {
-    obp0_reg = val;
+    regs.obp0 = val;
+    reg_written(OBP0_REG, val);
 }
 
 byte ppu_obp1_read() {
-    return obp1_reg;
+    return regs.obp1;
 }
 void ppu_obp1_write(byte val) {
-    obp1_reg = val;
+    regs.obp1 = val;
+    reg_written(OBP1_REG, val);
 }
 
 byte ppu_wy_read() {
-    return wy_reg;
+    return regs.wy;
 }
 void ppu_wy_write(byte val) {
-    wy_reg = val;
+    regs.wy = val;
+    reg_written(WY_REG, val);
 }
 
 byte ppu_wx_read() {
-    return wx_reg;
+    return regs.wx;
 }
 void ppu_wx_write(byte val) {
-    wx_reg = val;
+    regs.wx = val;
+    reg_written(WX_REG, val);
 }
 
 /* */
@@ -523,44 +1228,44 @@ static bool fifo_pop(fifo *f, pixel *p)
     return true;
 }
 
-static bool bg_fifo_fill(pixel *p)
+static bool bg_fifo_fill(ppu_pipe *p, pixel *px)
 {
-    if (bg_fifo.head != 8)
+    if (p->bg_fifo.head != 8)
         return false;
-    
-    memcpy(bg_fifo.pixels, p, 8 * sizeof(pixel));
-    bg_fifo.head = 0;
+
+    memcpy(p->bg_fifo.pixels, px, 8 * sizeof(pixel));
+    p->bg_fifo.head = 0;
     return true;
 }
 
-static bool obj_fifo_fill(pixel *p)
-{ 
+static bool obj_fifo_fill(ppu_pipe *p, pixel *px)
+{
     /* Merge. */
     int j = 0;
     while (j < 8) {
-        pixel new = p[j];
+        pixel new = px[j];
         pixel old;
-        if (fifo_pop(&obj_fifo, &old) && old.palette_idx != 0)
-            obj_fifo.pixels[j] = old;
+        if (fifo_pop(&p->obj_fifo, &old) && old.palette_idx != 0)
+            p->obj_fifo.pixels[j] = old;
         else
-            obj_fifo.pixels[j] = new;
+            p->obj_fifo.pixels[j] = new;
 
         j++;
     }
 
-    obj_fifo.head = 0;
+    p->obj_fifo.head = 0;
     return true;
 }
 
 /* */
 
-static void check_win_lx() {
-    if (window_mode || !(bg_win_enable() && win_enable()))
+static void check_win_lx(ppu_pipe *p) {
+    if (p->window_mode || !(bg_win_enable(p->r) && win_enable(p->r)))
         return;
 
-    if (wy_check && (byte)(lx_reg + 7) == wx_reg) {
-        fifo_clear(&bg_fifo); fetcher_clear(&bg_fetcher);
-        window_mode = true;
+    if (p->wy_check && (byte)(p->lx_reg + 7) == p->r->wx) {
+        fifo_clear(&p->bg_fifo); fetcher_clear(&p->bg_fetcher);
+        p->window_mode = true;
     }
 }
 
@@ -568,101 +1273,182 @@ static void fetcher_clear(fetcher *f) {
     f->dot = 0;
 }
 
-static void check_objs_lx()
+static void check_objs_lx(ppu_pipe *p)
 {
-    need_to_fetch_obj = false;
-    if (!obj_enable())
+    p->need_to_fetch_obj = false;
+    if (!obj_enable(p->r))
         return;
-    
-    for (int i = 0; i < scanline_objs_count; i++) {
-        obj_slot_type obj_slot = scanline_objs[i];
-        if ((byte)(lx_reg + 8) == obj_slot.obj_x) {
-            need_to_fetch_obj = true;
-            fetch_obj = obj_slot;
-            break;
+
+    /* LX + 8 only increases during mode 3, so objects left of it are done.
+       Of several objects at the same X, the first in OAM order is fetched. */
+    byte x = (byte)(p->lx_reg + 8);
+    while (p->obj_next < p->scanline_objs_count &&
+           p->scanline_objs[p->obj_order[p->obj_next]].obj_x < x)
+        p->obj_next++;
+    if (p->obj_next < p->scanline_objs_count) {
+        obj_slot_type obj_slot = p->scanline_objs[p->obj_order[p->obj_next]];
+        if (obj_slot.obj_x == x) {
+            p->need_to_fetch_obj = true;
+            p->fetch_obj = obj_slot;
+        }
+    }
+}
+
+/* Object line buckets. */
+
+static void rebuild_obj_buckets(void)
+{
+    for (int ly = 0; ly < GB_HEIGHT; ly++)
+        obj_buckets[ly].count = 0;
+
+    int height = obj_size(&regs) == 0 ? 8 : 16;
+    for (uint16_t addr = 0; addr < OAM_SIZE; addr += 4) {
+        int screen_start = oam[addr] - 16;
+        int first = screen_start < 0 ? 0 : screen_start;
+        int end = screen_start + height > GB_HEIGHT ? GB_HEIGHT : screen_start + height;
+        for (int ly = first; ly < end; ly++) {
+            obj_bucket *b = &obj_buckets[ly];
+            if (b->count == 10)
+                continue;
+            b->objs[b->count++] = (obj_slot_type){
+                OAM_START + addr, oam[addr + 1], oam[addr]
+            };
         }
     }
+    for (int ly = 0; ly < GB_HEIGHT; ly++)
+        sort_objs_by_x(obj_buckets[ly].objs, obj_buckets[ly].count,
+            obj_buckets[ly].order);
+
+    obj_buckets_stale = false;
+}
+
+/* Stable, so objects with equal X stay in OAM order. */
+static void sort_objs_by_x(const obj_slot_type *objs, int count, byte *order)
+{
+    for (int i = 0; i < count; i++) {
+        int j = i;
+        for (; j > 0 && objs[order[j - 1]].obj_x > objs[i].obj_x; j--)
+            order[j] = order[j - 1];
+        order[j] = (byte)i;
+    }
+}
+
+/* Puts the live scan in the state the dot by dot scan would have reached by
+   now, so that it can continue from there. */
+static void scan_catch_up(ppu_pipe *p)
+{
+    const obj_bucket *b = &obj_buckets[p->r->ly];
+    int entries = scanline_counter / 2;
+
+    p->scan_from_bucket = false;
+    p->scanline_objs_count = 0;
+    while (p->scanline_objs_count < b->count &&
+           b->objs[p->scanline_objs_count].addr < OAM_START + entries * 4)
+        p->scanline_objs_count++;
+    memcpy(p->scanline_objs, b->objs, sizeof(b->objs));
+    p->mode2_addr = OAM_START + entries * 4;
+    p->mode2_cycle = CHECK;
+
+    /* Halfway through an entry, its Y has been checked. */
+    if (scanline_counter % 2 == 1) {
+        int i = p->scanline_objs_count;
+        bool on_scanline = i < b->count && b->objs[i].addr == p->mode2_addr;
+        p->mode2_cycle = on_scanline ? PUSH : SKIP;
+    }
+}
+
+/* Called before OAM or the object size changes. */
+static void objs_changing(void)
+{
+    if (mode == MODE2_OAM && live.scan_from_bucket)
+        scan_catch_up(&live);
+    obj_buckets_stale = true;
 }
 
 /* TODO: Implement slice fetcher "stealing" for object penalties. */
-static void bg_fetcher_dot()
+static void bg_fetcher_dot(ppu_pipe *p)
 {
-    switch (bg_fetcher.dot) {
+    const ppu_regs *r = p->r;
+    fetcher *f = &p->bg_fetcher;
+    switch (f->dot) {
         /* Get tile ID. */
         case 0:
             bit map_area;
             byte tile_y;
             byte tile_x;
-            if (!window_mode) {
-                map_area = bg_map_area();
-                tile_y = (byte)(ly_reg + scy_reg) / 8;
-                tile_x = (byte)(bg_fetch_x + scx_reg) / 8;
+            if (!p->window_mode) {
+                map_area = bg_map_area(r);
+                tile_y = (byte)(r->ly + r->scy) / 8;
+                tile_x = (byte)(p->bg_fetch_x + r->scx) / 8;
             }
             else {
-                map_area = win_map_area();
-                tile_y = win_y / 8;
-                tile_x = win_x / 8;
+                map_area = win_map_area(r);
+                tile_y = p->win_y / 8;
+                tile_x = p->win_x / 8;
             }
 
-            bg_id_addr = (
+            p->bg_id_addr = (
                 0x9800                     |
                 ((uint16_t)map_area << 10) |
                 ((uint16_t)tile_y   <<  5) |
                 (uint16_t)tile_x);
-            bg_fetcher.dot++;
+            f->dot++;
             break;
         case 1:
-            bg_fetcher.tile_id = bus_read_ppu(bg_id_addr);
-            bg_fetcher.dot++;
+            if (p->render)
+                f->tile_id = pipe_read(p, p->bg_id_addr);
+            f->dot++;
             break;
         /* Get tile data (low). */
         case 2:
-            bit addr_mode = (bg_win_data_area() == 1 ?
-                    0 : !(get_bit(bg_fetcher.tile_id, 7)));
+            bit addr_mode = (bg_win_data_area(r) == 1 ?
+                    0 : !(get_bit(f->tile_id, 7)));
             byte data_line;
 
-            if (!window_mode)
-                data_line = (byte)(ly_reg + scy_reg) % 8;
+            if (!p->window_mode)
+                data_line = (byte)(r->ly + r->scy) % 8;
             else
-                data_line = win_y % 8;
-
-            bg_fetcher.data_addr = (
-                0x8000                               |
-                ((uint16_t)addr_mode          << 12) |
-                ((uint16_t)bg_fetcher.tile_id <<  4) |
-                ((uint16_t)data_line          <<  1));
-            bg_fetcher.dot++;
+                data_line = p->win_y % 8;
+
+            f->data_addr = (
+                0x8000                      |
+                ((uint16_t)addr_mode << 12) |
+                ((uint16_t)f->tile_id <<  4) |
+                ((uint16_t)data_line  <<  1));
+            f->dot++;
             break;
         case 3:
-            bg_fetcher.data_lo = bus_read_ppu(bg_fetcher.data_addr);
-            bg_fetcher.dot++;
+            if (p->render)
+                f->data_lo = pipe_read(p, f->data_addr);
+            f->dot++;
             break;
         /* Get tile data (high). */
         case 4:
-            bg_fetcher.data_addr += 1;
-            bg_fetcher.dot++;
+            f->data_addr += 1;
+            f->dot++;
             break;
         case 5:
-            bg_fetcher.data_hi = bus_read_ppu(bg_fetcher.data_addr);
-            bg_fetcher.dot++;
+            if (p->render)
+                f->data_hi = pipe_read(p, f->data_addr);
+            f->dot++;
             break;
         /* Push. */
         case 6:
-            for (int i = 0; i < 8; i++) {
+            for (int i = 0; p->render && i < 8; i++) {
                 int idx = 7 - i;
-                pixel p;
-                p.palette_idx = (
-                    (int)get_bit(bg_fetcher.data_hi, idx) << 1) |
-                    (int)get_bit(bg_fetcher.data_lo, idx);
-                bg_fetcher.pixels[i] = p;
+                pixel px;
+                px.palette_idx = (
+                    (int)get_bit(f->data_hi, idx) << 1) |
+                    (int)get_bit(f->data_lo, idx);
+                f->pixels[i] = px;
             }
-            bg_fetcher.dot++;
+            f->dot++;
         case 7:
-            if (bg_fifo_fill(bg_fetcher.pixels)) {
-                bg_fetch_x += 8;
-                if (window_mode)
-                    win_x += 8;
-                bg_fetcher.dot = 0;
+            if (bg_fifo_fill(p, f->pixels)) {
+                p->bg_fetch_x += 8;
+                if (p->window_mode)
+                    p->win_x += 8;
+                f->dot = 0;
             }
             break;
     }
@@ -674,71 +1460,239 @@ static byte flip_bits(byte b) {
         flipped |= ((b >> i) & 0x1) << (7 - i);
     return flipped;
 }
-static void obj_fetcher_dot()
+static void obj_fetcher_dot(ppu_pipe *p)
 {
-    switch (obj_fetcher.dot) {
+    const ppu_regs *r = p->r;
+    fetcher *f = &p->obj_fetcher;
+    switch (f->dot) {
         /* Get tile ID. */
         case 0:
-            obj_fetcher.tile_id = bus_read_ppu(fetch_obj.addr + 2);
-            obj_fetcher.dot++;
+            if (p->render)
+                f->tile_id = pipe_read(p, p->fetch_obj.addr + 2);
+            f->dot++;
             break;
         case 1:
-            obj_fetch_attribs = bus_read_ppu(fetch_obj.addr + 3);
-            if (obj_size() == 1) {
+            if (p->render)
+                p->obj_fetch_attribs = pipe_read(p, p->fetch_obj.addr + 3);
+            if (obj_size(r) == 1) {
                 /* Default -- First tile of 8 x 16 object. */
                 bit override = 0;
-                if (ly_reg >= fetch_obj.obj_y - 8)
+                if (r->ly >= p->fetch_obj.obj_y - 8)
                     /* Second tile of 8 x 16 object. */
                     override = 1;
-                if (get_bit(obj_fetch_attribs, 6) == 1)
+                if (get_bit(p->obj_fetch_attribs, 6) == 1)
                     override = !override;
-                obj_fetcher.tile_id = set_bit(obj_fetcher.tile_id, 0, override);
+                f->tile_id = set_bit(f->tile_id, 0, override);
             }
-            obj_fetcher.dot++;
+            f->dot++;
             break;
         /* Get tile data (low). */
         case 2:
-            byte data_line = (byte)(ly_reg - fetch_obj.obj_y) % 8;
-            if (get_bit(obj_fetch_attribs, 6))
+            byte data_line = (byte)(r->ly - p->fetch_obj.obj_y) % 8;
+            if (get_bit(p->obj_fetch_attribs, 6))
                 data_line = (~data_line) & 0x7;
-            obj_fetcher.data_addr = (
-                0x8000                               |
-                ((uint16_t)obj_fetcher.tile_id << 4) |
-                ((uint16_t)data_line           << 1));
-            obj_fetcher.dot++;
+            f->data_addr = (
+                0x8000                      |
+                ((uint16_t)f->tile_id << 4) |
+                ((uint16_t)data_line  << 1));
+            f->dot++;
             break;
         case 3:
-            obj_fetcher.data_lo = bus_read_ppu(obj_fetcher.data_addr);
-            if (get_bit(obj_fetch_attribs, 5))
-                obj_fetcher.data_lo = flip_bits(obj_fetcher.data_lo);
-            obj_fetcher.dot++;
+            if (p->render) {
+                f->data_lo = pipe_read(p, f->data_addr);
+                if (get_bit(p->obj_fetch_attribs, 5))
+                    f->data_lo = flip_bits(f->data_lo);
+            }
+            f->dot++;
             break;
         /* Get tile data (high). */
         case 4:
-            obj_fetcher.data_addr += 1;
-            obj_fetcher.dot++;
+            f->data_addr += 1;
+            f->dot++;
             break;
         case 5:
-            obj_fetcher.data_hi = bus_read_ppu(obj_fetcher.data_addr);
-            if (get_bit(obj_fetch_attribs, 5))
-                obj_fetcher.data_hi = flip_bits(obj_fetcher.data_hi);
-            obj_fetcher.dot++;
+            if (p->render) {
+                f->data_hi = pipe_read(p, f->data_addr);
+                if (get_bit(p->obj_fetch_attribs, 5))
+                    f->data_hi = flip_bits(f->data_hi);
+            }
+            f->dot++;
             break;
         /* Push. */
         case 6:
-            for (int i = 0; i < 8; i++) {
-                int idx = 7 - i;
-                pixel p;
-                p.palette_idx = (
-                    (int)get_bit(obj_fetcher.data_hi, idx) << 1) |
-                    (int)get_bit(obj_fetcher.data_lo, idx);
-                p.palette = get_bit(obj_fetch_attribs, 4);
-                p.priority = get_bit(obj_fetch_attribs, 7);
-                obj_fetcher.pixels[i] = p;
+            if (p->render) {
+                for (int i = 0; i < 8; i++) {
+                    int idx = 7 - i;
+                    pixel px;
+                    px.palette_idx = (
+                        (int)get_bit(f->data_hi, idx) << 1) |
+                        (int)get_bit(f->data_lo, idx);
+                    px.palette = get_bit(p->obj_fetch_attribs, 4);
+                    px.priority = get_bit(p->obj_fetch_attribs, 7);
+                    f->pixels[i] = px;
+                }
+                obj_fifo_fill(p, f->pixels);
             }
-            obj_fifo_fill(obj_fetcher.pixels);
-            obj_fetcher.dot = 0;
-            need_to_fetch_obj = false;
+            f->dot = 0;
+            p->need_to_fetch_obj = false;
             break;
     }
-}
\ No newline at end of file
+}
+
+/* Render worker. */
+
+static void ring_publish(void)
+{
+    SDL_SetAtomicInt(&ring_tail, (int)ring_tail_pending);
+    if (SDL_SetAtomicInt(&worker_waiting, 0) == 1)
+        SDL_SignalSemaphore(ring_data);
+}
+
+static void emit(event_kind kind, uint16_t addr, byte val, uint16_t arg)
+{
+    while (ring_tail_pending - ring_head_cached == EVENT_RING_SIZE) {
+        ring_head_cached = (unsigned int)SDL_GetAtomicInt(&ring_head);
+        if (ring_tail_pending - ring_head_cached < EVENT_RING_SIZE)
+            break;
+        /* Full -- let the worker drain what is already queued. */
+        ring_publish();
+        SDL_SetAtomicInt(&producer_waiting, 1);
+        if ((unsigned int)SDL_GetAtomicInt(&ring_head) == ring_head_cached)
+            SDL_WaitSemaphoreTimeout(ring_space, 1);
+        SDL_SetAtomicInt(&producer_waiting, 0);
+    }
+
+    event_ring[ring_tail_pending & EVENT_RING_MASK] = (pipe_event){
+        scanline_counter, kind, val, addr, arg
+    };
+    ring_tail_pending++;
+}
+
+static void emit_dma_block(void)
+{
+    int block = (dma_is_active() ? 1 : 0) | (bus_dma_blocks_vram() ? 2 : 0);
+    if (block != emitted_dma_block) {
+        emitted_dma_block = block;
+        emit(EV_DMA_BLOCK, 0, block, 0);
+    }
+}
+
+static void mirror_apply(ppu_mirror *m, const pipe_event *ev)
+{
+    switch (ev->kind) {
+        case EV_VRAM:
+            m->vram[ev->addr - VRAM_START] = ev->val;
+            break;
+        case EV_OAM_DMA:
+            m->dma_val = ev->val;
+        case EV_OAM:
+            m->oam[ev->addr - OAM_START] = ev->val;
+            break;
+        case EV_DMA_BLOCK:
+            m->dma_blocks_oam = (ev->val & 1) != 0;
+            m->dma_blocks_vram = (ev->val & 2) != 0;
+            break;
+        case EV_REG:
+            regs_apply(&m->regs, ev->addr, ev->val);
+            break;
+    }
+}
+
+/* Blocks until at least one unread event is published. Returns the published
+   tail. */
+static unsigned int ring_wait(unsigned int head)
+{
+    while (true) {
+        unsigned int tail = (unsigned int)SDL_GetAtomicInt(&ring_tail);
+        if (tail != head)
+            return tail;
+        SDL_SetAtomicInt(&worker_waiting, 1);
+        if ((unsigned int)SDL_GetAtomicInt(&ring_tail) == head)
+            SDL_WaitSemaphoreTimeout(ring_data, 10);
+        SDL_SetAtomicInt(&worker_waiting, 0);
+    }
+}
+
+static void ring_release(unsigned int head)
+{
+    SDL_SetAtomicInt(&ring_head, (int)head);
+    if (SDL_GetAtomicInt(&producer_waiting) == 1)
+        SDL_SignalSemaphore(ring_space);
+}
+
+/* Replays a scanline from the events in [first, end), where end is the index
+   of the EV_LINE_END event. */
+static void render_line(ppu_pipe *p, unsigned int first, unsigned int end)
+{
+    unsigned int next = first;
+    int dot = 0;
+
+    pipe_begin_mode2(p);
+    for (; dot < MODE2_OAM_T_CYCLES; dot++) {
+        for (; next != end && event_ring[next & EVENT_RING_MASK].dot <= dot; next++)
+            mirror_apply(p->mem, &event_ring[next & EVENT_RING_MASK]);
+        mode2_dot(p);
+    }
+    pipe_begin_mode3(p);
+    for (; !p->mode3_draw_complete && dot < T_CYCLES_PER_SCANLINE; dot++) {
+        for (; next != end && event_ring[next & EVENT_RING_MASK].dot <= dot; next++)
+            mirror_apply(p->mem, &event_ring[next & EVENT_RING_MASK]);
+        mode3_dot(p);
+    }
+    for (; next != end; next++)
+        mirror_apply(p->mem, &event_ring[next & EVENT_RING_MASK]);
+}
+
+static int loop_render(void *_)
+{
+    unsigned int head = (unsigned int)SDL_GetAtomicInt(&ring_head);
+    while (true) {
+        unsigned int tail = ring_wait(head);
+        pipe_event ev = event_ring[head & EVENT_RING_MASK];
+
+        switch (ev.kind) {
+            case EV_LINE:
+                /* Wait for the whole line to be published. */
+                unsigned int end = head + 1;
+                while (true) {
+                    for (; end != tail; end++) {
+                        event_kind kind = event_ring[end & EVENT_RING_MASK].kind;
+                        if (kind == EV_LINE_END || kind == EV_LCD_OFF ||
+                            kind == EV_QUIT)
+                            break;
+                    }
+                    if (end != tail)
+                        break;
+                    ring_release(head);
+                    tail = ring_wait(tail);
+                }
+                mirror.regs.ly = ev.val;
+                worker_pipe.win_y = ev.arg;
+                if (event_ring[end & EVENT_RING_MASK].kind == EV_LINE_END) {
+                    render_line(&worker_pipe, head + 1, end);
+                    head = end + 1;
+                }
+                else {
+                    /* Cut short -- keep the mirror in step only. */
+                    head++;
+                }
+                break;
+            case EV_FRAME:
+                commit_frame(ev.val);
+                head++;
+                break;
+            case EV_LCD_OFF:
+                commit_off_frame();
+                head++;
+                break;
+            case EV_QUIT:
+                ring_release(head + 1);
+                return 0;
+            default:
+                mirror_apply(&mirror, &ev);
+                head++;
+                break;
+        }
+        ring_release(head);
+    }
+}
@@ -1,5 +1,6 @@
 #pragma once
 #include "byte.h"
+#include "snapshot.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <SDL3/SDL.h>
@@ -13,17 +14,54 @@ typedef enum {
     LCD_DISABLED
 } ppu_mode;
 
-bool ppu_init(SDL_Mutex *frame_mux);
+/* Shade index used for a blank (disabled) LCD. */
+#define PPU_OFF_COLOR 4
+
+/* Four shades followed by the blank LCD color, each as 0xRRGGBB. */
+#define PPU_NUM_COLORS 5
+typedef uint32_t ppu_colors[PPU_NUM_COLORS];
+#define PPU_NUM_PALETTES 2
+
+/* Pixel format of produced frames.
+   INDEX8 frames hold shade indices (0-3, or PPU_OFF_COLOR) to be resolved by
+   the consumer. The other formats have the selected palette already applied,
+   and match the SDL pixel formats of the same name. */
+typedef enum {
+    PPU_FORMAT_INDEX8,
+    PPU_FORMAT_RGBA8888,
+    PPU_FORMAT_RGB565
+} ppu_format;
+
+typedef struct {
+    uint64_t published;
+    uint64_t dropped;    /* Published, then overwritten before being read. */
+    uint64_t duplicated; /* Acquired with no new frame available. */
+    uint64_t skipped;    /* Emulated without pixels by frameskip. */
+} ppu_frame_stats;
+
+bool ppu_init(ppu_format format, bool threaded, bool incremental);
+void ppu_deinit(void);
 void ppu_tick(void);
+void ppu_snapshot(snapshot *s);
+void ppu_set_output(bool render, bool publish);
+void ppu_request_frame_skip(bool skip);
 
 byte vram_read(uint16_t addr);
 void vram_write(uint16_t addr, byte val);
 
 byte oam_read(uint16_t addr);
 void oam_write(uint16_t addr, byte val);
+void oam_dma_write(uint16_t addr, byte val);
 
 ppu_mode ppu_get_mode(void);
-uint8_t *ppu_get_frame_buffer(void);
+const void *ppu_acquire_frame(bool *is_new);
+void ppu_set_frame_ready_callback(void (*fn)(void));
+void ppu_set_frame_tap(void (*fn)(const void *frame));
+const bool *ppu_get_dirty_lines(void);
+int ppu_get_frame_pitch(void);
+const uint32_t *ppu_get_palette_colors(int idx);
+void ppu_select_palette(int idx);
+ppu_frame_stats ppu_get_frame_stats(void);
 
 byte ppu_lcdc_read(void);
 void ppu_lcdc_write(byte val);
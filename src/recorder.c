@@ -0,0 +1,344 @@
+#include "recorder.h"
+#include "system.h"
+#include <SDL3/SDL.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#define FRAME_PIXELS (GB_WIDTH * GB_HEIGHT)
+#define Y4M_FRAME_HEADER "FRAME\n"
+#define Y4M_FRAME_HEADER_LEN (sizeof(Y4M_FRAME_HEADER) - 1)
+
+static recorder_args args;
+static FILE *out;
+static bool write_failed;
+static int in_bpp;
+static size_t in_size;
+static size_t out_size;
+/* Y, Cb and Cr of each INDEX8 shade. */
+static byte index_yuv[PPU_NUM_COLORS][3];
+
+/* Ring of frames. The producer fills the slot at head before queuing it, and
+   the writer takes the queued slots from tail on. */
+typedef struct {
+    byte *data;
+    int count;
+} rec_slot;
+static rec_slot *slots;
+static byte *slot_data;
+static int head, tail, queued;
+/* Frames dropped or skipped since the last queued one. */
+static int pending_repeats;
+static byte *last_queued;
+static SDL_Mutex *lock;
+static SDL_Condition *has_frames;
+static SDL_Condition *has_space;
+static bool stopping;
+
+/* Batches are written once half the ring is queued, or after a timeout. */
+#define FLUSH_TIMEOUT_MS 250
+static int batch_frames;
+static byte *staging;
+static size_t staging_size;
+static size_t staging_len;
+
+static SDL_Thread *writer;
+static recorder_stats stats;
+static bool started = false;
+
+static int loop_writer(void *data);
+static void write_slot(const rec_slot *slot);
+static void flush_staging(void);
+
+static void free_ring(void)
+{
+    SDL_DestroyCondition(has_space);
+    SDL_DestroyCondition(has_frames);
+    SDL_DestroyMutex(lock);
+    SDL_free(staging);
+    SDL_free(slot_data);
+    SDL_free(slots);
+    has_space = has_frames = NULL;
+    lock = NULL;
+    staging = slot_data = NULL;
+    slots = NULL;
+}
+
+static inline void rgb_to_yuv(int r, int g, int b, byte yuv[3])
+{
+    /* BT.601, limited range. */
+    yuv[0] = (byte)(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+    yuv[1] = (byte)((-38 * r - 74 * g + 112 * b + 128 + (128 << 8)) >> 8);
+    yuv[2] = (byte)((112 * r - 94 * g - 18 * b + 128 + (128 << 8)) >> 8);
+}
+
+bool recorder_parse_format(const char *name, rec_format *format)
+{
+    if (strcmp(name, "y4m") == 0)
+        *format = REC_FORMAT_Y4M;
+    else if (strcmp(name, "raw") == 0)
+        *format = REC_FORMAT_RAW;
+    else {
+        SDL_SetError("Unknown recording format %s", name);
+        return false;
+    }
+    return true;
+}
+
+bool recorder_parse_policy(const char *name, rec_policy *policy)
+{
+    if (strcmp(name, "block") == 0)
+        *policy = REC_BLOCK;
+    else if (strcmp(name, "drop") == 0)
+        *policy = REC_DROP;
+    else {
+        SDL_SetError("Unknown recording policy %s", name);
+        return false;
+    }
+    return true;
+}
+
+bool recorder_start(recorder_args _args)
+{
+    args = _args;
+    write_failed = false;
+    stats = (recorder_stats){ 0 };
+    head = tail = queued = 0;
+    pending_repeats = 0;
+    last_queued = NULL;
+    stopping = false;
+    staging_len = 0;
+
+    switch (args.frame_format) {
+        case PPU_FORMAT_INDEX8: in_bpp = 1; break;
+        case PPU_FORMAT_RGB565: in_bpp = 2; break;
+        default:                in_bpp = 4; break;
+    }
+    in_size = (size_t)FRAME_PIXELS * in_bpp;
+    if (args.format == REC_FORMAT_Y4M) {
+        out_size = Y4M_FRAME_HEADER_LEN + 3 * FRAME_PIXELS;
+        for (int i = 0; args.palette != NULL && i < PPU_NUM_COLORS; i++) {
+            uint32_t rgb = args.palette[i];
+            rgb_to_yuv((rgb >> 16) & 0xFF, (rgb >> 8) & 0xFF, rgb & 0xFF,
+                index_yuv[i]);
+        }
+    }
+    else
+        out_size = in_size;
+
+    args.buffers = SDL_max(args.buffers, 2);
+    batch_frames = args.buffers / 2;
+    slots = SDL_calloc(args.buffers, sizeof(rec_slot));
+    slot_data = SDL_malloc(in_size * args.buffers);
+    staging_size = out_size * batch_frames;
+    staging = SDL_malloc(staging_size);
+    if (slots == NULL || slot_data == NULL || staging == NULL)
+        goto failure;
+    for (int i = 0; i < args.buffers; i++)
+        slots[i].data = slot_data + in_size * i;
+
+    lock = SDL_CreateMutex();
+    has_frames = SDL_CreateCondition();
+    has_space = SDL_CreateCondition();
+    if (lock == NULL || has_frames == NULL || has_space == NULL)
+        goto failure;
+
+    out = strcmp(args.path, "-") == 0 ? stdout : fopen(args.path, "wb");
+    if (out == NULL) {
+        SDL_SetError("Could not open %s", args.path);
+        goto failure;
+    }
+    /* Writes are already batched. */
+    setvbuf(out, NULL, _IONBF, 0);
+    if (args.format == REC_FORMAT_Y4M) {
+        /* 2^22 Hz / 70224 T-cycles per frame. */
+        fprintf(out, "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C444\n",
+            GB_WIDTH, GB_HEIGHT, T_CYCLES_PER_SEC, T_CYCLES_PER_FRAME);
+    }
+
+    writer = SDL_CreateThread(&loop_writer, "MyDMG recorder", NULL);
+    if (writer == NULL)
+        goto failure;
+    started = true;
+    return true;
+failure:
+    if (out != NULL && out != stdout)
+        fclose(out);
+    out = NULL;
+    free_ring();
+    return false;
+}
+
+void recorder_stop(void)
+{
+    if (!started)
+        return;
+    started = false;
+
+    SDL_LockMutex(lock);
+    stopping = true;
+    SDL_SignalCondition(has_frames);
+    SDL_UnlockMutex(lock);
+    SDL_WaitThread(writer, NULL);
+    writer = NULL;
+
+    /* Frames dropped or skipped at the end repeat the last one queued, which
+       the producer no longer writes to. */
+    if (pending_repeats > 0 && last_queued != NULL) {
+        write_slot(&(rec_slot){ last_queued, pending_repeats });
+        flush_staging();
+        if (!write_failed)
+            stats.frames += pending_repeats;
+    }
+
+    if (out != stdout)
+        fclose(out);
+    else
+        fflush(out);
+    out = NULL;
+    free_ring();
+}
+
+void recorder_push_frame(const void *frame)
+{
+    SDL_LockMutex(lock);
+    if (frame == NULL) {
+        stats.skipped++;
+        pending_repeats++;
+        SDL_UnlockMutex(lock);
+        return;
+    }
+    if (queued == args.buffers) {
+        if (args.policy == REC_DROP) {
+            stats.dropped++;
+            pending_repeats++;
+            SDL_UnlockMutex(lock);
+            return;
+        }
+        Uint64 start = SDL_GetTicksNS();
+        while (queued == args.buffers)
+            SDL_WaitCondition(has_space, lock);
+        stats.blocked_ns += SDL_GetTicksNS() - start;
+    }
+    SDL_UnlockMutex(lock);
+
+    /* The slot at head is not visible to the writer until queued. */
+    memcpy(slots[head].data, frame, in_size);
+    slots[head].count = 1 + pending_repeats;
+    pending_repeats = 0;
+    last_queued = slots[head].data;
+    head = (head + 1) % args.buffers;
+
+    SDL_LockMutex(lock);
+    if (++queued >= batch_frames)
+        SDL_SignalCondition(has_frames);
+    SDL_UnlockMutex(lock);
+}
+
+recorder_stats recorder_get_stats(void)
+{
+    if (!started)
+        return stats;
+    SDL_LockMutex(lock);
+    recorder_stats copy = stats;
+    SDL_UnlockMutex(lock);
+    return copy;
+}
+
+/* Writer thread */
+
+static void flush_staging(void)
+{
+    if (staging_len == 0)
+        return;
+    if (!write_failed && fwrite(staging, 1, staging_len, out) != staging_len) {
+        SDL_Log("Recording stopped: could not write to %s", args.path);
+        write_failed = true;
+    }
+    SDL_LockMutex(lock);
+    if (!write_failed) {
+        stats.bytes += staging_len;
+        stats.writes++;
+    }
+    SDL_UnlockMutex(lock);
+    staging_len = 0;
+}
+
+static void convert_y4m(const byte *src, byte *dst)
+{
+    memcpy(dst, Y4M_FRAME_HEADER, Y4M_FRAME_HEADER_LEN);
+    byte *y_plane = dst + Y4M_FRAME_HEADER_LEN;
+    byte *u_plane = y_plane + FRAME_PIXELS;
+    byte *v_plane = u_plane + FRAME_PIXELS;
+    for (int i = 0; i < FRAME_PIXELS; i++) {
+        byte yuv[3];
+        switch (args.frame_format) {
+            case PPU_FORMAT_INDEX8:
+                memcpy(yuv, index_yuv[src[i]], sizeof(yuv));
+                break;
+            case PPU_FORMAT_RGB565: {
+                uint16_t px = ((const uint16_t *)src)[i];
+                int r = (px >> 11) & 0x1F, g = (px >> 5) & 0x3F, b = px & 0x1F;
+                rgb_to_yuv((r << 3) | (r >> 2), (g << 2) | (g >> 4),
+                    (b << 3) | (b >> 2), yuv);
+                break;
+            }
+            default: {
+                uint32_t px = ((const uint32_t *)src)[i];
+                rgb_to_yuv(px >> 24, (px >> 16) & 0xFF, (px >> 8) & 0xFF, yuv);
+                break;
+            }
+        }
+        y_plane[i] = yuv[0];
+        u_plane[i] = yuv[1];
+        v_plane[i] = yuv[2];
+    }
+}
+
+static void write_slot(const rec_slot *slot)
+{
+    for (int i = 0; i < slot->count; i++) {
+        if (staging_len + out_size > staging_size)
+            flush_staging();
+        byte *dst = staging + staging_len;
+        if (args.format == REC_FORMAT_Y4M)
+            convert_y4m(slot->data, dst);
+        else
+            memcpy(dst, slot->data, in_size);
+        staging_len += out_size;
+    }
+}
+
+static int loop_writer(void *_)
+{
+    while (true) {
+        SDL_LockMutex(lock);
+        while (queued < batch_frames && !stopping) {
+            if (!SDL_WaitConditionTimeout(has_frames, lock, FLUSH_TIMEOUT_MS))
+                break;
+        }
+        int n = queued;
+        bool done = stopping && n == 0;
+        SDL_UnlockMutex(lock);
+        if (done)
+            break;
+
+        /* The slots taken stay owned by this thread until released. */
+        int frames = 0;
+        for (int i = 0; i < n; i++) {
+            const rec_slot *slot = &slots[(tail + i) % args.buffers];
+            write_slot(slot);
+            frames += slot->count;
+        }
+        flush_staging();
+
+        SDL_LockMutex(lock);
+        tail = (tail + n) % args.buffers;
+        queued -= n;
+        if (!write_failed)
+            stats.frames += frames;
+        SDL_SignalCondition(has_space);
+        SDL_UnlockMutex(lock);
+    }
+    return 0;
+}
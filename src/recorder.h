@@ -0,0 +1,52 @@
+#pragma once
+#include "ppu.h"
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Records completed frames to a Y4M (4:4:4) or raw stream. Frames are copied
+   into a ring of buffers, and a writer thread converts and writes them out in
+   large batches. Frames that are dropped, or emulated without pixels, are
+   made up for by repeating the next one, so the stream keeps the DMG frame
+   rate. */
+
+typedef enum {
+    REC_FORMAT_Y4M,
+    REC_FORMAT_RAW  /* Frames as produced by the PPU, without padding. */
+} rec_format;
+
+/* What to do with a frame when the ring is full. */
+typedef enum {
+    REC_BLOCK, /* Wait for the writer, slowing emulation down. */
+    REC_DROP   /* Drop the frame. */
+} rec_policy;
+
+typedef struct {
+    const char *path; /* "-" for standard output. */
+    rec_format format;
+    rec_policy policy;
+    int buffers;
+    ppu_format frame_format;
+    /* Colors of INDEX8 frames, for Y4M. */
+    const uint32_t *palette;
+} recorder_args;
+
+typedef struct {
+    uint64_t frames;     /* Written, counting repeats. */
+    uint64_t dropped;
+    uint64_t skipped;    /* Emulated without pixels. */
+    uint64_t bytes;
+    uint64_t writes;
+    uint64_t blocked_ns; /* Spent by the producer waiting for the writer. */
+} recorder_stats;
+
+/* From the names used on the command line. */
+bool recorder_parse_format(const char *name, rec_format *format);
+bool recorder_parse_policy(const char *name, rec_policy *policy);
+
+bool recorder_start(recorder_args args);
+/* Writes out the frames still queued. */
+void recorder_stop(void);
+/* Called by the frame producer. frame is NULL for frames emulated without
+   pixels. */
+void recorder_push_frame(const void *frame);
+recorder_stats recorder_get_stats(void);
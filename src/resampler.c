@@ -0,0 +1,280 @@
+#include "resampler.h"
+#include <SDL3/SDL.h>
+
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RESAMPLER_X86
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* Taps are a multiple of this, so vector loops need no remainder. */
+#define TAP_ALIGN 16
+/* Input frames appended at a time, past those the kernel spans. */
+#define BLOCK_FRAMES 4096
+
+typedef struct {
+    int zero_crossings; /* Of the sinc, each side, at the output rate. */
+    double attenuation; /* dB, for the Kaiser window. */
+    int phase_bits;
+} quality_params;
+
+static const quality_params params[RESAMPLER_NUM_QUALITIES] = {
+    { 8, 60, 6 },
+    { 16, 80, 7 },
+    { 32, 100, 8 },
+};
+
+typedef void (*dot_fn)(const float *taps, const float *left,
+    const float *right, int n, float out[2]);
+
+static resampler_isa isa;
+static dot_fn dot;
+
+static int taps;
+static int phase_bits;
+/* taps floats per phase. Phase p is for windows starting p/2^phase_bits
+   frames after the output position. */
+static float *kernel;
+/* Deinterleaved input, from the oldest frame still needed. */
+static float *hist[2];
+static int hist_len;
+static int hist_size;
+/* Position of the next output frame's window in hist, and the distance
+   between output frames, in input frames as 32.32 fixed point. */
+static uint64_t pos;
+static uint64_t step;
+
+/* Modified Bessel function of the first kind, order 0. */
+static double bessel_i0(double x)
+{
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+/* Kaiser-windowed sinc, cut off at half the output rate. Aliases only fold
+   back into the transition band above the passband. */
+static void init_kernel(double ratio, const quality_params *q)
+{
+    int phases = 1 << q->phase_bits;
+    double cutoff = 0.5 / ratio;
+    double beta = 0.1102 * (q->attenuation - 8.7);
+    double i0_beta = bessel_i0(beta);
+    double half = taps / 2.0;
+    for (int p = 0; p < phases; p++) {
+        float *dst = &kernel[(size_t)p * taps];
+        double sum = 0;
+        for (int k = 0; k < taps; k++) {
+            double x = k - half + (double)p / phases;
+            double sinc = x == 0 ? 1 : SDL_sin(2 * SDL_PI_D * cutoff * x) /
+                (2 * SDL_PI_D * cutoff * x);
+            double r = x / half;
+            double window = r * r < 1 ? bessel_i0(beta * SDL_sqrt(1 - r * r)) /
+                i0_beta : 0;
+            dst[k] = (float)(sinc * window);
+            sum += dst[k];
+        }
+        /* Unity gain at DC for every phase. */
+        for (int k = 0; k < taps; k++)
+            dst[k] = (float)(dst[k] / sum);
+    }
+}
+
+static void dot_scalar(const float *k, const float *left, const float *right,
+    int n, float out[2])
+{
+    float l = 0, r = 0;
+    for (int i = 0; i < n; i++) {
+        l += k[i] * left[i];
+        r += k[i] * right[i];
+    }
+    out[0] = l;
+    out[1] = r;
+}
+
+#ifdef RESAMPLER_X86
+TARGET_AVX2 static float hsum256(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+/* Two accumulators a channel, to overlap the additions. */
+TARGET_AVX2 static void dot_avx2(const float *k, const float *left,
+    const float *right, int n, float out[2])
+{
+    __m256 l0 = _mm256_setzero_ps(), l1 = _mm256_setzero_ps();
+    __m256 r0 = _mm256_setzero_ps(), r1 = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 16) {
+        __m256 k0 = _mm256_loadu_ps(k + i);
+        __m256 k1 = _mm256_loadu_ps(k + i + 8);
+        l0 = _mm256_add_ps(l0, _mm256_mul_ps(k0, _mm256_loadu_ps(left + i)));
+        l1 = _mm256_add_ps(l1, _mm256_mul_ps(k1, _mm256_loadu_ps(left + i + 8)));
+        r0 = _mm256_add_ps(r0, _mm256_mul_ps(k0, _mm256_loadu_ps(right + i)));
+        r1 = _mm256_add_ps(r1, _mm256_mul_ps(k1, _mm256_loadu_ps(right + i + 8)));
+    }
+    out[0] = hsum256(_mm256_add_ps(l0, l1));
+    out[1] = hsum256(_mm256_add_ps(r0, r1));
+}
+#endif
+
+bool resampler_set_isa(resampler_isa _isa)
+{
+    switch (_isa) {
+        case RESAMPLER_ISA_SCALAR:
+            dot = &dot_scalar;
+            break;
+#ifdef RESAMPLER_X86
+        case RESAMPLER_ISA_AVX2:
+            if (!SDL_HasAVX2())
+                return false;
+            dot = &dot_avx2;
+            break;
+#endif
+        default:
+            return false;
+    }
+    isa = _isa;
+    return true;
+}
+
+resampler_isa resampler_get_isa(void)
+{
+    return isa;
+}
+
+const char *resampler_isa_name(resampler_isa _isa)
+{
+    static const char *names[RESAMPLER_NUM_ISAS] = { "scalar", "avx2" };
+    return names[_isa];
+}
+
+const char *resampler_quality_name(resampler_quality quality)
+{
+    static const char *names[RESAMPLER_NUM_QUALITIES] = {
+        "fast", "medium", "best"
+    };
+    return names[quality];
+}
+
+bool resampler_parse_quality(const char *name, resampler_quality *quality)
+{
+    for (int q = 0; q < RESAMPLER_NUM_QUALITIES; q++) {
+        if (strcmp(name, resampler_quality_name((resampler_quality)q)) == 0) {
+            *quality = (resampler_quality)q;
+            return true;
+        }
+    }
+    SDL_SetError("Unknown resampler quality %s", name);
+    return false;
+}
+
+int resampler_get_taps(void)
+{
+    return taps;
+}
+
+bool resampler_init(int in_rate, int out_rate, resampler_quality quality)
+{
+    if (out_rate <= 0 || in_rate < out_rate) {
+        SDL_SetError("Cannot resample from %d Hz to %d Hz", in_rate, out_rate);
+        return false;
+    }
+    if (!resampler_set_isa(RESAMPLER_ISA_AVX2))
+        resampler_set_isa(RESAMPLER_ISA_SCALAR);
+
+    const quality_params *q = &params[quality];
+    double ratio = (double)in_rate / out_rate;
+    taps = (int)SDL_ceil(2 * q->zero_crossings * ratio);
+    taps = (taps + TAP_ALIGN - 1) / TAP_ALIGN * TAP_ALIGN;
+    phase_bits = q->phase_bits;
+    step = ((uint64_t)in_rate << 32) / out_rate;
+    pos = 0;
+    /* Starts from silence. */
+    hist_len = taps;
+    hist_size = taps + BLOCK_FRAMES + (int)(step >> 32) + 1;
+
+    kernel = SDL_malloc(((size_t)taps << phase_bits) * sizeof(float));
+    hist[0] = SDL_calloc(hist_size, sizeof(float));
+    hist[1] = SDL_calloc(hist_size, sizeof(float));
+    if (kernel == NULL || hist[0] == NULL || hist[1] == NULL) {
+        resampler_deinit();
+        return false;
+    }
+    init_kernel(ratio, q);
+    return true;
+}
+
+void resampler_deinit(void)
+{
+    SDL_free(kernel);
+    SDL_free(hist[0]);
+    SDL_free(hist[1]);
+    kernel = hist[0] = hist[1] = NULL;
+}
+
+static inline int16_t to_sample(float x)
+{
+    x = SDL_clamp(x, -32768.0f, 32767.0f);
+    return (int16_t)(x < 0 ? x - 0.5f : x + 0.5f);
+}
+
+/* Computes the output frames whose windows are complete, then drops the
+   input frames before the next window. */
+static int run(int16_t *out)
+{
+    int produced = 0;
+    int frac_shift = 32 - phase_bits;
+    while (true) {
+        /* The window starts at the first frame at or after the position,
+           rounded to the nearest phase, and the phase is the distance
+           between them. */
+        uint64_t p = (pos + (1ull << (frac_shift - 1))) >> frac_shift;
+        int phase = (int)(-p & ((1u << phase_bits) - 1));
+        int start = (int)(p >> phase_bits) + (phase != 0);
+        if (start + taps > hist_len)
+            break;
+        float lr[2];
+        dot(&kernel[(size_t)phase * taps], hist[0] + start, hist[1] + start,
+            taps, lr);
+        out[produced * 2] = to_sample(lr[0]);
+        out[produced * 2 + 1] = to_sample(lr[1]);
+        produced++;
+        pos += step;
+    }
+
+    int drop = (int)(pos >> 32);
+    if (drop > 0) {
+        for (int c = 0; c < 2; c++)
+            memmove(hist[c], hist[c] + drop, (hist_len - drop) * sizeof(float));
+        hist_len -= drop;
+        pos -= (uint64_t)drop << 32;
+    }
+    return produced;
+}
+
+int resampler_process(const int16_t *in, int in_frames, int16_t *out)
+{
+    int produced = 0;
+    while (in_frames > 0) {
+        int n = SDL_min(in_frames, hist_size - hist_len);
+        float *left = hist[0] + hist_len;
+        float *right = hist[1] + hist_len;
+        for (int i = 0; i < n; i++) {
+            left[i] = in[i * 2];
+            right[i] = in[i * 2 + 1];
+        }
+        hist_len += n;
+        in += n * 2;
+        in_frames -= n;
+        produced += run(out + produced * 2);
+    }
+    return produced;
+}
@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* Polyphase windowed-sinc decimator, from the APU's native rate down to the
+   host's. Each output sample is the dot product of the last few hundred
+   input samples with the kernel phase nearest to its position between them;
+   the dot products of both channels are computed together, 16 taps at a
+   time with AVX2. */
+
+/* Longer kernels attenuate aliases more and keep more of the treble, at a
+   cost proportional to their length. */
+typedef enum {
+    RESAMPLER_FAST,   /* Flat to 0.39 of the output rate, -60 dB aliases. */
+    RESAMPLER_MEDIUM, /* 0.42, -80 dB. */
+    RESAMPLER_BEST,   /* 0.45, -100 dB. */
+    RESAMPLER_NUM_QUALITIES
+} resampler_quality;
+
+typedef enum {
+    RESAMPLER_ISA_SCALAR,
+    RESAMPLER_ISA_AVX2,
+    RESAMPLER_NUM_ISAS
+} resampler_isa;
+
+/* in_rate must be at least out_rate. */
+bool resampler_init(int in_rate, int out_rate, resampler_quality quality);
+void resampler_deinit(void);
+/* The fastest the host supports is selected by resampler_init. */
+bool resampler_set_isa(resampler_isa isa);
+resampler_isa resampler_get_isa(void);
+const char *resampler_isa_name(resampler_isa isa);
+const char *resampler_quality_name(resampler_quality quality);
+bool resampler_parse_quality(const char *name, resampler_quality *quality);
+/* Taps of each kernel phase. */
+int resampler_get_taps(void);
+
+/* Takes interleaved stereo frames, and writes the output frames completed
+   by them to out, which needs room for in_frames + 1. Returns the number
+   written. */
+int resampler_process(const int16_t *in, int in_frames, int16_t *out);
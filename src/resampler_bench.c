@@ -0,0 +1,147 @@
+#include <SDL3/SDL.h>
+#include "system.h"
+#include "apu.h"
+#include "resampler.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Times the resampler at each quality with each instruction set the host
+   supports, on one thread, and compares every output with the scalar one. */
+
+#define CHUNK_FRAMES 512
+
+static const char *rom_path;
+static int seconds = 10;
+static int out_rate = 48000;
+static int16_t *input;
+static int input_frames;
+static int16_t *reference[RESAMPLER_NUM_QUALITIES];
+static int16_t *output;
+
+static void on_samples(const int16_t *samples, int frames)
+{
+    int n = SDL_min(frames, APU_NATIVE_RATE - input_frames);
+    memcpy(&input[input_frames * 2], samples, (size_t)n * 2 * sizeof(int16_t));
+    input_frames += n;
+}
+
+/* One second at the native rate: the ROM's output after 300 frames, or two
+   detuned square waves without one. */
+static bool load_input(void)
+{
+    input = SDL_malloc((size_t)APU_NATIVE_RATE * 2 * sizeof(int16_t));
+    if (input == NULL)
+        return false;
+    if (rom_path == NULL) {
+        for (int i = 0; i < APU_NATIVE_RATE; i++) {
+            input[i * 2] = (i / 1192) & 1 ? 6000 : -6000;
+            input[i * 2 + 1] = (i / 1187) & 1 ? 6000 : -6000;
+        }
+        input_frames = APU_NATIVE_RATE;
+        return true;
+    }
+
+    system_args sys_args = (system_args){
+        rom_path, PPU_FORMAT_RGBA8888, false, false, APU_NATIVE_RATE, false
+    };
+    if (!sys_init(sys_args))
+        return false;
+    for (int i = 0; i < 300 * M_CYCLES_PER_FRAME; i++)
+        sys_tick();
+    sys_flush_audio();
+    sys_set_audio_sink(&on_samples);
+    while (input_frames < APU_NATIVE_RATE)
+        sys_tick();
+    sys_set_audio_sink(NULL);
+    sys_deinit();
+    return true;
+}
+
+static bool run_case(resampler_quality q, resampler_isa isa)
+{
+    if (!resampler_init(APU_NATIVE_RATE, out_rate, q))
+        return false;
+    if (!resampler_set_isa(isa)) {
+        resampler_deinit();
+        return true;
+    }
+
+    int produced = 0;
+    Uint64 start = SDL_GetTicksNS();
+    for (int s = 0; s < seconds; s++) {
+        produced = 0;
+        for (int i = 0; i < input_frames; i += CHUNK_FRAMES) {
+            int n = SDL_min(input_frames - i, CHUNK_FRAMES);
+            produced += resampler_process(&input[i * 2], n,
+                &output[produced * 2]);
+        }
+    }
+    double secs = (double)(SDL_GetTicksNS() - start) / 1e9;
+    int taps = resampler_get_taps();
+    resampler_deinit();
+
+    /* The last pass is compared. */
+    size_t size = (size_t)produced * 2 * sizeof(int16_t);
+    if (reference[q] == NULL) {
+        reference[q] = SDL_malloc(size);
+        if (reference[q] != NULL)
+            memcpy(reference[q], output, size);
+    }
+    int max_diff = 0;
+    for (int i = 0; reference[q] != NULL && i < produced * 2; i++)
+        max_diff = SDL_max(max_diff, abs(output[i] - reference[q][i]));
+
+    double in_total = (double)input_frames * seconds;
+    printf("%-6s  %4d taps  %-6s  %8.2f M in/s  %7.1fx realtime  "
+        "max diff %d\n",
+        resampler_quality_name(q), taps, resampler_isa_name(isa),
+        in_total / secs / 1e6, in_total / secs / APU_NATIVE_RATE, max_diff);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    /* Usage: mydmg-resampler-bench [--seconds N] [--rate HZ]
+                                    [ROM path] */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--seconds") == 0 && i + 1 < argc) {
+            i++;
+            seconds = SDL_max(atoi(argv[i]), 1);
+        }
+        else if (strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            i++;
+            out_rate = SDL_clamp(atoi(argv[i]), 8000, 192000);
+        }
+        else if (rom_path == NULL)
+            rom_path = argv[i];
+    }
+
+    int code = 0;
+    /* The output has fewer frames than the input. */
+    output = SDL_malloc(((size_t)APU_NATIVE_RATE + 1) * 2 * sizeof(int16_t));
+    if (output == NULL || !load_input())
+        goto failure;
+
+    printf("%d Hz to %d Hz, %d s of input per case\n", APU_NATIVE_RATE,
+        out_rate, seconds);
+    /* The scalar run of each quality comes first and is the reference. */
+    for (int q = 0; q < RESAMPLER_NUM_QUALITIES; q++) {
+        for (int isa = 0; isa < RESAMPLER_NUM_ISAS; isa++) {
+            if (!run_case((resampler_quality)q, (resampler_isa)isa))
+                goto failure;
+        }
+    }
+    goto close;
+failure:
+    SDL_Log("Error: %s", SDL_GetError());
+    code = 1;
+close:
+    for (int q = 0; q < RESAMPLER_NUM_QUALITIES; q++)
+        SDL_free(reference[q]);
+    SDL_free(output);
+    SDL_free(input);
+    SDL_Quit();
+    return code;
+}
@@ -0,0 +1,580 @@
+#include "scaler.h"
+#include "system.h"
+#include <SDL3/SDL.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SCALER_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+/* The frame is copied with its edge pixels repeated this far out, so filters
+   can read neighbours without bounds checks. */
+#define PAD_X 8
+#define PAD_Y 2
+#define PAD_W (GB_WIDTH + 2 * PAD_X)
+static uint32_t padded[GB_HEIGHT + 2 * PAD_Y][PAD_W];
+
+/* Scale4x doubles the rows of its band, plus two on either side, before
+   doubling them again. */
+#define TEMP_W (2 * GB_WIDTH + 2 * PAD_X)
+
+#define MAX_THREADS 8
+
+typedef void (*nearest_row_fn)(const uint32_t *src, int width, int factor,
+    uint32_t *out);
+typedef void (*scale2x_row_fn)(const uint32_t *up, const uint32_t *mid,
+    const uint32_t *down, int width, uint32_t *out0, uint32_t *out1);
+typedef void (*scale3x_row_fn)(const uint32_t *up, const uint32_t *mid,
+    const uint32_t *down, int width, uint32_t *out[3]);
+
+static scaler_isa isa;
+static nearest_row_fn nearest_row;
+static scale2x_row_fn scale2x_row;
+static scale3x_row_fn scale3x_row;
+
+typedef struct {
+    scaler_filter filter;
+    int factor;
+    byte *dst;
+    int dst_pitch;
+} scaler_job;
+static scaler_job job;
+
+/* Band 0 is scaled by the calling thread, the others by workers. */
+static int num_bands = 0;
+static SDL_Thread *workers[MAX_THREADS];
+static SDL_Semaphore *work_ready[MAX_THREADS];
+static SDL_Semaphore *work_done;
+static uint32_t *band_temp[MAX_THREADS];
+static bool quitting;
+
+/* Scalar */
+
+static void nearest_row_scalar(const uint32_t *src, int width, int factor,
+    uint32_t *out)
+{
+    for (int x = 0; x < width; x++) {
+        for (int i = 0; i < factor; i++)
+            *out++ = src[x];
+    }
+}
+
+static void scale2x_row_scalar(const uint32_t *up, const uint32_t *mid,
+    const uint32_t *down, int width, uint32_t *out0, uint32_t *out1)
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t b = up[x];
+        uint32_t d = mid[x - 1], e = mid[x], f = mid[x + 1];
+        uint32_t h = down[x];
+        bool edge = b != h && d != f;
+        out0[2 * x]     = edge && d == b ? d : e;
+        out0[2 * x + 1] = edge && b == f ? f : e;
+        out1[2 * x]     = edge && d == h ? d : e;
+        out1[2 * x + 1] = edge && h == f ? f : e;
+    }
+}
+
+static void scale3x_row_scalar(const uint32_t *up, const uint32_t *mid,
+    const uint32_t *down, int width, uint32_t *out[3])
+{
+    for (int x = 0; x < width; x++) {
+        uint32_t a = up[x - 1], b = up[x], c = up[x + 1];
+        uint32_t d = mid[x - 1], e = mid[x], f = mid[x + 1];
+        uint32_t g = down[x - 1], h = down[x], i = down[x + 1];
+        uint32_t *o0 = out[0] + 3 * x;
+        uint32_t *o1 = out[1] + 3 * x;
+        uint32_t *o2 = out[2] + 3 * x;
+        if (b == h || d == f) {
+            o0[0] = o0[1] = o0[2] = e;
+            o1[0] = o1[1] = o1[2] = e;
+            o2[0] = o2[1] = o2[2] = e;
+            continue;
+        }
+        o0[0] = d == b ? d : e;
+        o0[1] = (d == b && e != c) || (b == f && e != a) ? b : e;
+        o0[2] = b == f ? f : e;
+        o1[0] = (d == b && e != g) || (d == h && e != a) ? d : e;
+        o1[1] = e;
+        o1[2] = (b == f && e != i) || (h == f && e != c) ? f : e;
+        o2[0] = d == h ? d : e;
+        o2[1] = (d == h && e != i) || (h == f && e != g) ? h : e;
+        o2[2] = h == f ? f : e;
+    }
+}
+
+/* Sum of the absolute differences of the four channels. */
+static inline int color_dist(uint32_t a, uint32_t b)
+{
+    int dist = 0;
+    for (int shift = 0; shift < 32; shift += 8)
+        dist += abs((int)((a >> shift) & 0xFF) - (int)((b >> shift) & 0xFF));
+    return dist;
+}
+
+static inline uint32_t blend_half(uint32_t a, uint32_t b)
+{
+    return ((a >> 1) & 0x7F7F7F7F) + ((b >> 1) & 0x7F7F7F7F) +
+        (a & b & 0x01010101);
+}
+
+/* The bottom right quarter of the pixel at p, after mirroring the
+   neighbourhood by sx and sy. Neighbours are named after 2xBR's:
+          A1 B1 C1
+       A0 A  B  C  C4
+       D0 D  E  F  F4
+       G0 G  H  I  I4
+          G5 H5 I5      */
+static uint32_t xbr_corner(const uint32_t *p, int pitch, int sx, int sy)
+{
+#define N(dx, dy) p[(dx) * sx + (dy) * sy * pitch]
+    uint32_t e = N(0, 0);
+    uint32_t b = N(0, -1), c = N(1, -1);
+    uint32_t d = N(-1, 0), f = N(1, 0), f4 = N(2, 0);
+    uint32_t g = N(-1, 1), h = N(0, 1), i = N(1, 1), i4 = N(2, 1);
+    uint32_t h5 = N(0, 2), i5 = N(1, 2);
+#undef N
+    if (e == f || e == h)
+        return e;
+
+    /* An edge runs along F-H when colors change less along it than across. */
+    int along = color_dist(e, c) + color_dist(e, g) + color_dist(i, f4) +
+        color_dist(i, h5) + 4 * color_dist(h, f);
+    int across = color_dist(h, d) + color_dist(h, i5) + color_dist(f, i4) +
+        color_dist(f, b) + 4 * color_dist(e, i);
+    if (along >= across)
+        return e;
+    return blend_half(e, color_dist(e, f) <= color_dist(e, h) ? f : h);
+}
+
+static void xbr2x_row(const uint32_t *mid, int pitch, int width,
+    uint32_t *out0, uint32_t *out1)
+{
+    for (int x = 0; x < width; x++) {
+        const uint32_t *p = mid + x;
+        out0[2 * x]     = xbr_corner(p, pitch, -1, -1);
+        out0[2 * x + 1] = xbr_corner(p, pitch,  1, -1);
+        out1[2 * x]     = xbr_corner(p, pitch, -1,  1);
+        out1[2 * x + 1] = xbr_corner(p, pitch,  1,  1);
+    }
+}
+
+#ifdef SCALER_X86
+
+/* SSE2 -- 4 pixels at a time. Widths must be multiples of 4. */
+
+TARGET_SSE2 static inline __m128i select128(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+#define LOAD128(p) _mm_loadu_si128((const __m128i *)(p))
+#define STORE128(p, v) _mm_storeu_si128((__m128i *)(p), (v))
+
+TARGET_SSE2 static void nearest_row_sse2(const uint32_t *src, int width,
+    int factor, uint32_t *out)
+{
+    if (factor == 2) {
+        for (int x = 0; x < width; x += 4) {
+            __m128i e = LOAD128(src + x);
+            STORE128(out + 2 * x, _mm_unpacklo_epi32(e, e));
+            STORE128(out + 2 * x + 4, _mm_unpackhi_epi32(e, e));
+        }
+    }
+    else if (factor == 4) {
+        for (int x = 0; x < width; x += 4) {
+            __m128i e = LOAD128(src + x);
+            __m128i lo = _mm_unpacklo_epi32(e, e);
+            __m128i hi = _mm_unpackhi_epi32(e, e);
+            STORE128(out + 4 * x, _mm_unpacklo_epi64(lo, lo));
+            STORE128(out + 4 * x + 4, _mm_unpackhi_epi64(lo, lo));
+            STORE128(out + 4 * x + 8, _mm_unpacklo_epi64(hi, hi));
+            STORE128(out + 4 * x + 12, _mm_unpackhi_epi64(hi, hi));
+        }
+    }
+    else
+        nearest_row_scalar(src, width, factor, out);
+}
+
+TARGET_SSE2 static void scale2x_row_sse2(const uint32_t *up, const uint32_t *mid,
+    const uint32_t *down, int width, uint32_t *out0, uint32_t *out1)
+{
+    for (int x = 0; x < width; x += 4) {
+        __m128i b = LOAD128(up + x);
+        __m128i d = LOAD128(mid + x - 1);
+        __m128i e = LOAD128(mid + x);
+        __m128i f = LOAD128(mid + x + 1);
+        __m128i h = LOAD128(down + x);
+        __m128i flat = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+        __m128i e0 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(d, b)), d, e);
+        __m128i e1 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(b, f)), f, e);
+        __m128i e2 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(d, h)), d, e);
+        __m128i e3 = select128(_mm_andnot_si128(flat, _mm_cmpeq_epi32(h, f)), f, e);
+        STORE128(out0 + 2 * x, _mm_unpacklo_epi32(e0, e1));
+        STORE128(out0 + 2 * x + 4, _mm_unpackhi_epi32(e0, e1));
+        STORE128(out1 + 2 * x, _mm_unpacklo_epi32(e2, e3));
+        STORE128(out1 + 2 * x + 4, _mm_unpackhi_epi32(e2, e3));
+    }
+}
+
+/* Stores a0 b0 c0 a1 b1 c1 a2 b2 c2 a3 b3 c3. */
+TARGET_SSE2 static inline void store3_sse2(uint32_t *out,
+    __m128i a, __m128i b, __m128i c)
+{
+    __m128 ab_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(a, b));
+    __m128 ab_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(a, b));
+    __m128 bc_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(b, c));
+    __m128 bc_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(b, c));
+    __m128 ca_lo = _mm_castsi128_ps(_mm_unpacklo_epi32(c, a));
+    __m128 ca_hi = _mm_castsi128_ps(_mm_unpackhi_epi32(c, a));
+    _mm_storeu_ps((float *)out, _mm_shuffle_ps(ab_lo, ca_lo, _MM_SHUFFLE(3, 0, 1, 0)));
+    _mm_storeu_ps((float *)out + 4, _mm_shuffle_ps(bc_lo, ab_hi, _MM_SHUFFLE(1, 0, 3, 2)));
+    _mm_storeu_ps((float *)out + 8, _mm_shuffle_ps(ca_hi, bc_hi, _MM_SHUFFLE(3, 2, 3, 0)));
+}
+
+TARGET_SSE2 static void scale3x_row_sse2(const uint32_t *up, const uint32_t *mid,
+    const uint32_t *down, int width, uint32_t *out[3])
+{
+    for (int x = 0; x < width; x += 4) {
+        __m128i a = LOAD128(up + x - 1), b = LOAD128(up + x), c = LOAD128(up + x + 1);
+        __m128i d = LOAD128(mid + x - 1), e = LOAD128(mid + x), f = LOAD128(mid + x + 1);
+        __m128i g = LOAD128(down + x - 1), h = LOAD128(down + x), i = LOAD128(down + x + 1);
+        __m128i flat = _mm_or_si128(_mm_cmpeq_epi32(b, h), _mm_cmpeq_epi32(d, f));
+        __m128i db = _mm_andnot_si128(flat, _mm_cmpeq_epi32(d, b));
+        __m128i bf = _mm_andnot_si128(flat, _mm_cmpeq_epi32(b, f));
+        __m128i dh = _mm_andnot_si128(flat, _mm_cmpeq_epi32(d, h));
+        __m128i hf = _mm_andnot_si128(flat, _mm_cmpeq_epi32(h, f));
+        __m128i ea = _mm_cmpeq_epi32(e, a), ec = _mm_cmpeq_epi32(e, c);
+        __m128i eg = _mm_cmpeq_epi32(e, g), ei = _mm_cmpeq_epi32(e, i);
+
+        store3_sse2(out[0] + 3 * x,
+            select128(db, d, e),
+            select128(_mm_or_si128(_mm_andnot_si128(ec, db), _mm_andnot_si128(ea, bf)), b, e),
+            select128(bf, f, e));
+        store3_sse2(out[1] + 3 * x,
+            select128(_mm_or_si128(_mm_andnot_si128(eg, db), _mm_andnot_si128(ea, dh)), d, e),
+            e,
+            select128(_mm_or_si128(_mm_andnot_si128(ei, bf), _mm_andnot_si128(ec, hf)), f, e));
+        store3_sse2(out[2] + 3 * x,
+            select128(dh, d, e),
+            select128(_mm_or_si128(_mm_andnot_si128(ei, dh), _mm_andnot_si128(eg, hf)), h, e),
+            select128(hf, f, e));
+    }
+}
+
+/* AVX2 -- 8 pixels at a time. Widths must be multiples of 8. */
+
+TARGET_AVX2 static inline __m256i select256(__m256i mask, __m256i a, __m256i b)
+{
+    return _mm256_blendv_epi8(b, a, mask);
+}
+
+#define LOAD256(p) _mm256_loadu_si256((const __m256i *)(p))
+#define STORE256(p, v) _mm256_storeu_si256((__m256i *)(p), (v))
+
+TARGET_AVX2 static void nearest_row_avx2(const uint32_t *src, int width,
+    int factor, uint32_t *out)
+{
+    if (factor > 9) {
+        nearest_row_scalar(src, width, factor, out);
+        return;
+    }
+    /* Output pixel l of block j repeats source pixel (8 * j + l) / factor. */
+    __m256i index[9];
+    for (int j = 0; j < factor; j++) {
+        index[j] = _mm256_setr_epi32(
+            (8 * j + 0) / factor, (8 * j + 1) / factor,
+            (8 * j + 2) / factor, (8 * j + 3) / factor,
+            (8 * j + 4) / factor, (8 * j + 5) / factor,
+            (8 * j + 6) / factor, (8 * j + 7) / factor);
+    }
+    for (int x = 0; x < width; x += 8) {
+        __m256i e = LOAD256(src + x);
+        for (int j = 0; j < factor; j++)
+            STORE256(out + factor * x + 8 * j, _mm256_permutevar8x32_epi32(e, index[j]));
+    }
+}
+
+TARGET_AVX2 static void scale2x_row_avx2(const uint32_t *up, const uint32_t *mid,
+    const uint32_t *down, int width, uint32_t *out0, uint32_t *out1)
+{
+    for (int x = 0; x < width; x += 8) {
+        __m256i b = LOAD256(up + x);
+        __m256i d = LOAD256(mid + x - 1);
+        __m256i e = LOAD256(mid + x);
+        __m256i f = LOAD256(mid + x + 1);
+        __m256i h = LOAD256(down + x);
+        __m256i flat = _mm256_or_si256(_mm256_cmpeq_epi32(b, h), _mm256_cmpeq_epi32(d, f));
+        __m256i e0 = select256(_mm256_andnot_si256(flat, _mm256_cmpeq_epi32(d, b)), d, e);
+        __m256i e1 = select256(_mm256_andnot_si256(flat, _mm256_cmpeq_epi32(b, f)), f, e);
+        __m256i e2 = select256(_mm256_andnot_si256(flat, _mm256_cmpeq_epi32(d, h)), d, e);
+        __m256i e3 = select256(_mm256_andnot_si256(flat, _mm256_cmpeq_epi32(h, f)), f, e);
+        /* Unpacking works within 128-bit lanes, so the halves are swapped
+           back into order. */
+        __m256i lo = _mm256_unpacklo_epi32(e0, e1), hi = _mm256_unpackhi_epi32(e0, e1);
+        STORE256(out0 + 2 * x, _mm256_permute2x128_si256(lo, hi, 0x20));
+        STORE256(out0 + 2 * x + 8, _mm256_permute2x128_si256(lo, hi, 0x31));
+        lo = _mm256_unpacklo_epi32(e2, e3);
+        hi = _mm256_unpackhi_epi32(e2, e3);
+        STORE256(out1 + 2 * x, _mm256_permute2x128_si256(lo, hi, 0x20));
+        STORE256(out1 + 2 * x + 8, _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+}
+
+#endif
+
+bool scaler_set_isa(scaler_isa _isa)
+{
+    switch (_isa) {
+        case SCALER_ISA_SCALAR:
+            nearest_row = &nearest_row_scalar;
+            scale2x_row = &scale2x_row_scalar;
+            scale3x_row = &scale3x_row_scalar;
+            break;
+#ifdef SCALER_X86
+        case SCALER_ISA_SSE2:
+            if (!SDL_HasSSE2())
+                return false;
+            nearest_row = &nearest_row_sse2;
+            scale2x_row = &scale2x_row_sse2;
+            scale3x_row = &scale3x_row_sse2;
+            break;
+        case SCALER_ISA_AVX2:
+            if (!SDL_HasAVX2())
+                return false;
+            nearest_row = &nearest_row_avx2;
+            scale2x_row = &scale2x_row_avx2;
+            /* Interleaving by 3 gains little from 256-bit registers. */
+            scale3x_row = &scale3x_row_sse2;
+            break;
+#endif
+        default:
+            return false;
+    }
+    isa = _isa;
+    return true;
+}
+
+scaler_isa scaler_get_isa(void)
+{
+    return isa;
+}
+
+const char *scaler_isa_name(scaler_isa _isa)
+{
+    static const char *names[SCALER_NUM_ISAS] = { "scalar", "sse2", "avx2" };
+    return names[_isa];
+}
+
+const char *scaler_filter_name(scaler_filter filter)
+{
+    static const char *names[SCALER_NUM_FILTERS] = {
+        "nearest", "scale2x", "scale3x", "scale4x", "xbr2x"
+    };
+    return names[filter];
+}
+
+int scaler_output_factor(scaler_filter filter, int factor)
+{
+    switch (filter) {
+        case SCALER_NEAREST: return factor;
+        case SCALER_SCALE3X: return 3;
+        case SCALER_SCALE4X: return 4;
+        default:             return 2;
+    }
+}
+
+/* Bands */
+
+static inline const uint32_t *src_row(int y)
+{
+    return &padded[y + PAD_Y][PAD_X];
+}
+
+static inline uint32_t *dst_row(int y)
+{
+    return (uint32_t *)(job.dst + (size_t)y * job.dst_pitch);
+}
+
+static void pad_frame(const void *src, int src_pitch)
+{
+    for (int y = 0; y < GB_HEIGHT; y++) {
+        uint32_t *row = padded[y + PAD_Y];
+        memcpy(row + PAD_X, (const byte *)src + (size_t)y * src_pitch,
+            GB_WIDTH * sizeof(uint32_t));
+        for (int x = 0; x < PAD_X; x++) {
+            row[x] = row[PAD_X];
+            row[PAD_X + GB_WIDTH + x] = row[PAD_X + GB_WIDTH - 1];
+        }
+    }
+    for (int y = 0; y < PAD_Y; y++) {
+        memcpy(padded[y], padded[PAD_Y], sizeof(padded[0]));
+        memcpy(padded[PAD_Y + GB_HEIGHT + y], padded[PAD_Y + GB_HEIGHT - 1],
+            sizeof(padded[0]));
+    }
+}
+
+static int band_start(int band)
+{
+    return GB_HEIGHT * band / num_bands;
+}
+
+/* Doubles the band into temp, then doubles that. Row t of temp holds doubled
+   row 2 * y0 - 2 + t, with the rows beyond the frame's edges repeating its
+   edge rows, as for the source. */
+static void scale4x_band(int band, int y0, int y1)
+{
+    uint32_t *temp = band_temp[band];
+#define TEMP_ROW(t) (temp + (size_t)(t) * TEMP_W + PAD_X)
+    int width = 2 * GB_WIDTH;
+    int last = 2 * (y1 - y0) + 2;
+    for (int y = SDL_max(y0 - 1, 0); y < SDL_min(y1 + 1, GB_HEIGHT); y++) {
+        scale2x_row(src_row(y - 1), src_row(y), src_row(y + 1), GB_WIDTH,
+            TEMP_ROW(2 * (y - y0) + 2), TEMP_ROW(2 * (y - y0) + 3));
+    }
+    if (y0 == 0)
+        memcpy(TEMP_ROW(1), TEMP_ROW(2), width * sizeof(uint32_t));
+    if (y1 == GB_HEIGHT)
+        memcpy(TEMP_ROW(last), TEMP_ROW(last - 1), width * sizeof(uint32_t));
+    for (int t = 1; t <= last; t++) {
+        TEMP_ROW(t)[-1] = TEMP_ROW(t)[0];
+        TEMP_ROW(t)[width] = TEMP_ROW(t)[width - 1];
+    }
+
+    for (int t = 2; t < last; t++) {
+        int y = 2 * y0 - 2 + t;
+        scale2x_row(TEMP_ROW(t - 1), TEMP_ROW(t), TEMP_ROW(t + 1), width,
+            dst_row(2 * y), dst_row(2 * y + 1));
+    }
+#undef TEMP_ROW
+}
+
+static void run_band(int band)
+{
+    int y0 = band_start(band);
+    int y1 = band_start(band + 1);
+    int factor = job.factor;
+
+    switch (job.filter) {
+        case SCALER_NEAREST:
+            for (int y = y0; y < y1; y++) {
+                nearest_row(src_row(y), GB_WIDTH, factor, dst_row(y * factor));
+                for (int i = 1; i < factor; i++) {
+                    memcpy(dst_row(y * factor + i), dst_row(y * factor),
+                        GB_WIDTH * factor * sizeof(uint32_t));
+                }
+            }
+            break;
+        case SCALER_SCALE2X:
+            for (int y = y0; y < y1; y++) {
+                scale2x_row(src_row(y - 1), src_row(y), src_row(y + 1),
+                    GB_WIDTH, dst_row(2 * y), dst_row(2 * y + 1));
+            }
+            break;
+        case SCALER_SCALE3X:
+            for (int y = y0; y < y1; y++) {
+                uint32_t *out[3] = {
+                    dst_row(3 * y), dst_row(3 * y + 1), dst_row(3 * y + 2)
+                };
+                scale3x_row(src_row(y - 1), src_row(y), src_row(y + 1),
+                    GB_WIDTH, out);
+            }
+            break;
+        case SCALER_SCALE4X:
+            scale4x_band(band, y0, y1);
+            break;
+        case SCALER_XBR2X:
+            for (int y = y0; y < y1; y++) {
+                xbr2x_row(src_row(y), PAD_W, GB_WIDTH,
+                    dst_row(2 * y), dst_row(2 * y + 1));
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+static int loop_worker(void *data)
+{
+    int band = (int)(intptr_t)data;
+    while (true) {
+        SDL_WaitSemaphore(work_ready[band]);
+        if (quitting)
+            return 0;
+        run_band(band);
+        SDL_SignalSemaphore(work_done);
+    }
+}
+
+/* Pool */
+
+bool scaler_init(int threads)
+{
+    num_bands = SDL_clamp(threads, 1, MAX_THREADS);
+    quitting = false;
+    if (!scaler_set_isa(SCALER_ISA_AVX2) && !scaler_set_isa(SCALER_ISA_SSE2))
+        scaler_set_isa(SCALER_ISA_SCALAR);
+
+    work_done = SDL_CreateSemaphore(0);
+    if (work_done == NULL)
+        goto failure;
+    for (int band = 0; band < num_bands; band++) {
+        int rows = 2 * (band_start(band + 1) - band_start(band)) + 4;
+        band_temp[band] = SDL_malloc((size_t)rows * TEMP_W * sizeof(uint32_t));
+        if (band_temp[band] == NULL)
+            goto failure;
+    }
+    for (int band = 1; band < num_bands; band++) {
+        work_ready[band] = SDL_CreateSemaphore(0);
+        if (work_ready[band] == NULL)
+            goto failure;
+        workers[band] = SDL_CreateThread(&loop_worker, "MyDMG scaler",
+            (void *)(intptr_t)band);
+        if (workers[band] == NULL)
+            goto failure;
+    }
+    return true;
+failure:
+    scaler_deinit();
+    return false;
+}
+
+void scaler_deinit(void)
+{
+    quitting = true;
+    for (int band = 0; band < num_bands; band++) {
+        if (workers[band] != NULL) {
+            SDL_SignalSemaphore(work_ready[band]);
+            SDL_WaitThread(workers[band], NULL);
+            workers[band] = NULL;
+        }
+        if (work_ready[band] != NULL) {
+            SDL_DestroySemaphore(work_ready[band]);
+            work_ready[band] = NULL;
+        }
+        SDL_free(band_temp[band]);
+        band_temp[band] = NULL;
+    }
+    if (work_done != NULL) {
+        SDL_DestroySemaphore(work_done);
+        work_done = NULL;
+    }
+    num_bands = 0;
+}
+
+void scaler_run(scaler_filter filter, int factor,
+    const void *src, int src_pitch, void *dst, int dst_pitch)
+{
+    pad_frame(src, src_pitch);
+    job = (scaler_job){ filter, factor, dst, dst_pitch };
+
+    for (int band = 1; band < num_bands; band++)
+        SDL_SignalSemaphore(work_ready[band]);
+    run_band(0);
+    for (int band = 1; band < num_bands; band++)
+        SDL_WaitSemaphore(work_done);
+}
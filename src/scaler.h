@@ -0,0 +1,37 @@
+#pragma once
+#include <stdint.h>
+#include <stdbool.h>
+
+/* CPU upscalers for GB_WIDTH x GB_HEIGHT frames of 32-bit pixels. The rows
+   of a frame are split into bands scaled in parallel on a small thread pool. */
+
+typedef enum {
+    SCALER_NEAREST, /* Any integer factor. */
+    SCALER_SCALE2X,
+    SCALER_SCALE3X,
+    SCALER_SCALE4X, /* Scale2x applied twice. */
+    SCALER_XBR2X,   /* 2xBR: blends corners along detected edges. */
+    SCALER_NUM_FILTERS
+} scaler_filter;
+
+typedef enum {
+    SCALER_ISA_SCALAR,
+    SCALER_ISA_SSE2,
+    SCALER_ISA_AVX2,
+    SCALER_NUM_ISAS
+} scaler_isa;
+
+/* threads includes the calling thread. */
+bool scaler_init(int threads);
+void scaler_deinit(void);
+/* The fastest the host supports is selected by scaler_init. */
+bool scaler_set_isa(scaler_isa isa);
+scaler_isa scaler_get_isa(void);
+const char *scaler_isa_name(scaler_isa isa);
+const char *scaler_filter_name(scaler_filter filter);
+
+/* Multiple of the frame size produced. factor is only used by NEAREST. */
+int scaler_output_factor(scaler_filter filter, int factor);
+/* Pitches are in bytes. Not thread-safe: meant to be called by one thread. */
+void scaler_run(scaler_filter filter, int factor,
+    const void *src, int src_pitch, void *dst, int dst_pitch);
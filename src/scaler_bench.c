@@ -0,0 +1,140 @@
+#include <SDL3/SDL.h>
+#include "system.h"
+#include "scaler.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Times each upscaler with each instruction set the host supports, on one
+   thread and on the pool, and checks every output against the scalar one. */
+
+typedef struct {
+    scaler_filter filter;
+    int factor;
+} bench_case;
+
+static const bench_case cases[] = {
+    { SCALER_NEAREST, 2 },
+    { SCALER_NEAREST, 3 },
+    { SCALER_NEAREST, 4 },
+    { SCALER_SCALE2X, 2 },
+    { SCALER_SCALE3X, 3 },
+    { SCALER_SCALE4X, 4 },
+    { SCALER_XBR2X, 2 },
+};
+#define NUM_CASES (int)(sizeof(cases) / sizeof(cases[0]))
+#define MAX_FACTOR 4
+#define OUT_SIZE (GB_WIDTH * MAX_FACTOR * GB_HEIGHT * MAX_FACTOR)
+
+static const char *rom_path;
+static int iterations = 1000;
+static int threads;
+static uint32_t frame[GB_WIDTH * GB_HEIGHT];
+static uint32_t *reference[NUM_CASES];
+static uint32_t *output;
+
+/* The last of 300 frames of the ROM, or diagonal stripes without one. */
+static bool load_frame(void)
+{
+    if (rom_path == NULL) {
+        static const uint32_t shades[4] = {
+            0xE0F8D0FF, 0x88C070FF, 0x346856FF, 0x081820FF
+        };
+        for (int y = 0; y < GB_HEIGHT; y++) {
+            for (int x = 0; x < GB_WIDTH; x++)
+                frame[y * GB_WIDTH + x] = shades[((x + y) / 3 + (x / 16)) % 4];
+        }
+        return true;
+    }
+
+    system_args sys_args = (system_args){
+        rom_path, PPU_FORMAT_RGBA8888, false, false, 0, false
+    };
+    if (!sys_init(sys_args))
+        return false;
+    for (int i = 0; i < 300 * M_CYCLES_PER_FRAME; i++)
+        sys_tick();
+    const byte *src = sys_acquire_frame(NULL);
+    int pitch = sys_get_frame_pitch();
+    for (int y = 0; y < GB_HEIGHT; y++)
+        memcpy(&frame[y * GB_WIDTH], src + y * pitch, GB_WIDTH * sizeof(uint32_t));
+    sys_deinit();
+    return true;
+}
+
+static void run_case(int c, int pool)
+{
+    const bench_case *bc = &cases[c];
+    int factor = scaler_output_factor(bc->filter, bc->factor);
+    int dst_pitch = GB_WIDTH * factor * (int)sizeof(uint32_t);
+    size_t size = (size_t)dst_pitch * GB_HEIGHT * factor;
+
+    memset(output, 0, size);
+    Uint64 start = SDL_GetTicksNS();
+    for (int i = 0; i < iterations; i++) {
+        scaler_run(bc->filter, bc->factor, frame, GB_WIDTH * sizeof(uint32_t),
+            output, dst_pitch);
+    }
+    double us = (double)(SDL_GetTicksNS() - start) / 1e3 / iterations;
+
+    if (reference[c] == NULL) {
+        reference[c] = SDL_malloc(size);
+        if (reference[c] != NULL)
+            memcpy(reference[c], output, size);
+    }
+    bool match = reference[c] == NULL || memcmp(reference[c], output, size) == 0;
+
+    printf("%-8s x%d  %-6s  %d thread%s  %8.1f us  %8.1f Mpx/s%s\n",
+        scaler_filter_name(bc->filter), factor,
+        scaler_isa_name(scaler_get_isa()), pool, pool == 1 ? " " : "s",
+        us, (double)size / sizeof(uint32_t) / us,
+        match ? "" : "  MISMATCH");
+}
+
+int main(int argc, char *argv[])
+{
+    /* Usage: mydmg-scaler-bench [--iterations N] [--threads N] [ROM path] */
+    threads = SDL_min(SDL_GetNumLogicalCPUCores(), 4);
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--iterations") == 0 && i + 1 < argc) {
+            i++;
+            iterations = SDL_max(atoi(argv[i]), 1);
+        }
+        else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            i++;
+            threads = SDL_max(atoi(argv[i]), 1);
+        }
+        else if (rom_path == NULL)
+            rom_path = argv[i];
+    }
+
+    int code = 0;
+    output = SDL_malloc(OUT_SIZE * sizeof(uint32_t));
+    if (output == NULL || !load_frame())
+        goto failure;
+
+    /* The scalar single-threaded run comes first and is the reference. */
+    int pools[2] = { 1, threads };
+    for (int p = 0; p < (threads > 1 ? 2 : 1); p++) {
+        if (!scaler_init(pools[p]))
+            goto failure;
+        for (int isa = 0; isa < SCALER_NUM_ISAS; isa++) {
+            if (!scaler_set_isa((scaler_isa)isa))
+                continue;
+            for (int c = 0; c < NUM_CASES; c++)
+                run_case(c, pools[p]);
+        }
+        scaler_deinit();
+    }
+    goto close;
+failure:
+    SDL_Log("Error: %s", SDL_GetError());
+    code = 1;
+close:
+    for (int c = 0; c < NUM_CASES; c++)
+        SDL_free(reference[c]);
+    SDL_free(output);
+    SDL_Quit();
+    return code;
+}
@@ -0,0 +1,107 @@
+#include "shm_export.h"
+#include "system.h"
+#include "bus.h"
+#include <SDL3/SDL.h>
+
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#define SHM_SUPPORTED
+#endif
+
+#ifdef SHM_SUPPORTED
+
+static shm_region *region;
+static char *object_name;
+static size_t frame_size;
+static uint64_t frame_count;
+
+bool shm_export_start(const char *name, ppu_format format)
+{
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        SDL_SetError("Could not create shared memory %s", name);
+        return false;
+    }
+    bool ok = ftruncate(fd, sizeof(shm_region)) == 0;
+    void *mem = ok ? mmap(NULL, sizeof(shm_region), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (mem == MAP_FAILED) {
+        shm_unlink(name);
+        SDL_SetError("Could not map shared memory %s", name);
+        return false;
+    }
+    region = mem;
+    object_name = SDL_strdup(name);
+
+    int pitch = sys_get_frame_pitch();
+    frame_size = (size_t)pitch * GB_HEIGHT;
+    frame_count = 0;
+    region->frame_format = format;
+    region->frame_pitch = pitch;
+    region->version = SHM_VERSION;
+    atomic_store_explicit(&region->seq, 0, memory_order_relaxed);
+    /* Readers check the magic last. */
+    atomic_thread_fence(memory_order_release);
+    region->magic = SHM_MAGIC;
+    return true;
+}
+
+void shm_export_stop(void)
+{
+    if (region == NULL)
+        return;
+    munmap(region, sizeof(shm_region));
+    shm_unlink(object_name);
+    SDL_free(object_name);
+    region = NULL;
+    object_name = NULL;
+}
+
+void shm_export_publish(const void *frame)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    uint32_t seq = atomic_load_explicit(&region->seq, memory_order_relaxed);
+    atomic_store_explicit(&region->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    region->frame_count = ++frame_count;
+    region->publish_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    cpu_state cpu = sys_get_cpu_state();
+    region->cpu = (shm_cpu_regs){
+        cpu.af_reg, cpu.bc_reg, cpu.de_reg, cpu.hl_reg, cpu.sp_reg, cpu.pc_reg,
+        cpu.ime_flag, sys_peek(IE_REG)
+    };
+    memcpy(region->wram, sys_get_wram(), SHM_WRAM_SIZE);
+    memcpy(region->hram, sys_get_hram(), SHM_HRAM_SIZE);
+    if (frame != NULL)
+        memcpy(region->frame, frame, frame_size);
+
+    atomic_store_explicit(&region->seq, seq + 2, memory_order_release);
+}
+
+#else
+
+bool shm_export_start(const char *name, ppu_format format)
+{
+    (void)name;
+    (void)format;
+    return SDL_SetError("Shared memory export is not supported on this platform");
+}
+
+void shm_export_stop(void)
+{
+}
+
+void shm_export_publish(const void *frame)
+{
+    (void)frame;
+}
+
+#endif
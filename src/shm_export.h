@@ -0,0 +1,15 @@
+#pragma once
+#include "ppu.h"
+#include "shm_layout.h"
+#include <stdbool.h>
+
+/* Exports the latest frame, WRAM, HRAM and CPU registers through a POSIX
+   shared-memory object (see shm_layout.h). Not available on other platforms. */
+
+/* name is a shared-memory object name, e.g. "/mydmg". */
+bool shm_export_start(const char *name, ppu_format format);
+/* Unlinks the object. Readers that still map it keep the last update. */
+void shm_export_stop(void);
+/* Called by the emulation thread when a frame completes. frame is NULL for
+   frames emulated without pixels, which keep the last frame. */
+void shm_export_publish(const void *frame);
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdatomic.h>
+#include <stdint.h>
+
+/* Layout of the shared-memory region exported with --export-shm, for readers
+   in other processes. Only this header is needed to read it.
+
+   The emulation thread updates the region once per frame under a seqlock:
+   seq is odd while an update is in progress. A read is consistent if seq was
+   even before it and unchanged after it:
+
+       uint32_t s1 = atomic_load_explicit(&r->seq, memory_order_acquire);
+       ... copy the fields needed ...
+       atomic_thread_fence(memory_order_acquire);
+       uint32_t s2 = atomic_load_explicit(&r->seq, memory_order_relaxed);
+       consistent = (s1 & 1) == 0 && s1 == s2;  */
+
+#define SHM_MAGIC   0x474D444Du /* "MDMG" in memory on little-endian hosts */
+#define SHM_VERSION 1
+
+#define SHM_WIDTH  160
+#define SHM_HEIGHT 144
+#define SHM_FRAME_MAX_SIZE (SHM_WIDTH * SHM_HEIGHT * 4)
+#define SHM_WRAM_SIZE 0x2000
+#define SHM_HRAM_SIZE 0x7F
+
+typedef struct {
+    uint16_t af, bc, de, hl, sp, pc;
+    uint8_t ime;
+    uint8_t ie;
+} shm_cpu_regs;
+
+typedef struct {
+    /* Set once, before the first update. */
+    uint32_t magic;
+    uint32_t version;
+    uint32_t frame_format; /* 0: INDEX8, 1: RGBA8888, 2: RGB565 */
+    uint32_t frame_pitch;  /* Bytes per row. */
+
+    _Atomic uint32_t seq;
+    uint32_t reserved;
+
+    /* Protected by seq. */
+    uint64_t frame_count;  /* Counting frames emulated without pixels. */
+    uint64_t publish_ns;   /* CLOCK_MONOTONIC when the update started. */
+    shm_cpu_regs cpu;
+    uint8_t wram[SHM_WRAM_SIZE];
+    uint8_t hram[SHM_HRAM_SIZE];
+    uint8_t frame[SHM_FRAME_MAX_SIZE];
+} shm_region;
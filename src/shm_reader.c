@@ -0,0 +1,153 @@
+#include "shm_layout.h"
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+/* Example reader for the region exported with --export-shm. Prints the state
+   once, or with --bench measures how long updates take to be seen after they
+   are published, and how long a consistent copy takes. Reads make no system
+   calls -- waiting for an update spins on seq. */
+
+static const char *name = "/mydmg";
+static int bench_updates = 0;
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+/* Waits for an update newer than seq, returning its sequence number. */
+static uint32_t wait_update(const shm_region *r, uint32_t seq)
+{
+    while (true) {
+        uint32_t s = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if ((s & 1) == 0 && s != seq)
+            return s;
+    }
+}
+
+/* Copies the fields protected by seq, retrying while an update is in
+   progress. Returns the number of retries. */
+static int read_consistent(const shm_region *r, shm_region *copy)
+{
+    size_t start = offsetof(shm_region, frame_count);
+    for (int retries = 0; ; retries++) {
+        uint32_t s1 = atomic_load_explicit(&r->seq, memory_order_acquire);
+        if (s1 & 1)
+            continue;
+        memcpy((char *)copy + start, (const char *)r + start,
+            sizeof(shm_region) - start);
+        atomic_thread_fence(memory_order_acquire);
+        uint32_t s2 = atomic_load_explicit(&r->seq, memory_order_relaxed);
+        if (s1 == s2)
+            return retries;
+    }
+}
+
+static void print_state(const shm_region *s)
+{
+    uint64_t h = 0xCBF29CE484222325ull;
+    for (int i = 0; i < SHM_WRAM_SIZE; i++)
+        h = (h ^ s->wram[i]) * 0x100000001B3ull;
+    printf("frame %llu\n", (unsigned long long)s->frame_count);
+    printf("AF %04X BC %04X DE %04X HL %04X SP %04X PC %04X IME %d IE %02X\n",
+        s->cpu.af, s->cpu.bc, s->cpu.de, s->cpu.hl, s->cpu.sp, s->cpu.pc,
+        s->cpu.ime, s->cpu.ie);
+    printf("WRAM hash %016llx\n", (unsigned long long)h);
+    printf("HRAM FF80: %02X %02X %02X %02X %02X %02X %02X %02X\n",
+        s->hram[0], s->hram[1], s->hram[2], s->hram[3],
+        s->hram[4], s->hram[5], s->hram[6], s->hram[7]);
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return (x > y) - (x < y);
+}
+
+static void bench(const shm_region *r, shm_region *copy)
+{
+    uint64_t *latency = malloc(bench_updates * sizeof(uint64_t));
+    if (latency == NULL)
+        return;
+    uint64_t copy_ns = 0;
+    uint64_t retries = 0;
+    uint64_t missed = 0;
+    uint64_t last_frame = 0;
+
+    uint32_t seq = wait_update(r, atomic_load_explicit(&r->seq, memory_order_acquire));
+    for (int i = 0; i < bench_updates; i++) {
+        seq = wait_update(r, seq);
+        uint64_t seen = now_ns();
+        retries += read_consistent(r, copy);
+        copy_ns += now_ns() - seen;
+
+        latency[i] = seen - copy->publish_ns;
+        if (i > 0 && copy->frame_count > last_frame + 1)
+            missed += copy->frame_count - last_frame - 1;
+        last_frame = copy->frame_count;
+    }
+
+    qsort(latency, bench_updates, sizeof(uint64_t), &compare_u64);
+    printf("%d updates: latency p50 %.1f us, p99 %.1f us, max %.1f us\n",
+        bench_updates,
+        latency[bench_updates / 2] / 1e3,
+        latency[(int)(bench_updates * 0.99)] / 1e3,
+        latency[bench_updates - 1] / 1e3);
+    printf("copy %.1f us per update, %llu retries, %llu updates missed\n",
+        (double)copy_ns / bench_updates / 1e3,
+        (unsigned long long)retries, (unsigned long long)missed);
+    free(latency);
+}
+
+int main(int argc, char *argv[])
+{
+    /* Usage: mydmg-shm-reader [--bench N] [name] */
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc)
+            bench_updates = atoi(argv[++i]);
+        else
+            name = argv[i];
+    }
+
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open shared memory %s\n", name);
+        return 1;
+    }
+    const shm_region *r = mmap(NULL, sizeof(shm_region), PROT_READ,
+        MAP_SHARED, fd, 0);
+    close(fd);
+    if (r == MAP_FAILED) {
+        fprintf(stderr, "Could not map shared memory %s\n", name);
+        return 1;
+    }
+    if (r->magic != SHM_MAGIC || r->version != SHM_VERSION) {
+        fprintf(stderr, "%s is not a version %d MyDMG export\n", name, SHM_VERSION);
+        return 1;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    shm_region *copy = malloc(sizeof(shm_region));
+    if (copy == NULL)
+        return 1;
+    if (bench_updates > 0)
+        bench(r, copy);
+    else {
+        wait_update(r, 0);
+        read_consistent(r, copy);
+        print_state(copy);
+    }
+    free(copy);
+    munmap((void *)r, sizeof(shm_region));
+    return 0;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include "byte.h"
+#include <stddef.h>
+#include <string.h>
+
+/* In-memory machine state.
+   Each module lists its state once, in its _snapshot() function, which is then
+   used to measure, save and load it. */
+
+typedef enum {
+    SNAPSHOT_MEASURE,
+    SNAPSHOT_SAVE,
+    SNAPSHOT_LOAD
+} snapshot_pass;
+
+typedef struct {
+    snapshot_pass pass;
+    byte *data;
+    size_t pos;
+} snapshot;
+
+static inline void snapshot_field(snapshot *s, void *field, size_t size)
+{
+    switch (s->pass) {
+        case SNAPSHOT_SAVE: memcpy(s->data + s->pos, field, size); break;
+        case SNAPSHOT_LOAD: memcpy(field, s->data + s->pos, size); break;
+        case SNAPSHOT_MEASURE: break;
+    }
+    s->pos += size;
+}
+#define SNAPSHOT(s, var) snapshot_field((s), &(var), sizeof(var))
@@ -7,18 +7,25 @@
 #include "input.h"
 #include "dma.h"
 #include "cartridge.h"
+#include "apu.h"
 
 /* Work RAM. */
 static byte wram[WRAM_SIZE];
 
+static bool threaded_render;
+
 bool sys_init(system_args args)
 {
+    threaded_render = args.threaded_render;
     return (
-        cart_init(args.rom_path) &&
+        cart_init(args.rom_path, args.persist) &&
+        bus_init() &&
         timer_init() &&
+        apu_init(args.audio_rate) &&
         cpu_init() &&
         int_init() &&
-        ppu_init(args.frame_mux) &&
+        ppu_init(args.frame_format, args.threaded_render,
+            args.incremental_render) &&
         input_init() &&
         dma_init()
     );
@@ -31,20 +38,143 @@ void sys_tick()
     cpu_tick();
     ppu_tick();
     timer_tick();
+    apu_tick();
+    input_tick();
 }
 
-void sys_start_frame()
+void sys_start_frame(Uint64 start_ns, Uint64 span_ns)
+{
+    input_begin_frame(start_ns, span_ns);
+}
+void sys_push_key(SDL_Scancode scancode, bool pressed, Uint64 timestamp_ns)
 {
-    input_poll_and_load();
+    input_push_key(scancode, pressed, timestamp_ns);
 }
 
 void sys_deinit()
 {
+    ppu_deinit();
     cart_deinit();
 }
 
-uint8_t *sys_get_frame_buffer() {
-    return ppu_get_frame_buffer();
+static void snapshot_all(snapshot *s)
+{
+    SNAPSHOT(s, wram);
+    cart_snapshot(s);
+    timer_snapshot(s);
+    apu_snapshot(s);
+    cpu_snapshot(s);
+    int_snapshot(s);
+    ppu_snapshot(s);
+    input_snapshot(s);
+    dma_snapshot(s);
+    bus_snapshot(s);
+}
+
+bool sys_snapshot_init(sys_snapshot *snap)
+{
+    if (threaded_render) {
+        SDL_SetError("Snapshots are not supported with the render thread");
+        return false;
+    }
+
+    snapshot s = { SNAPSHOT_MEASURE, NULL, 0 };
+    snapshot_all(&s);
+    snap->size = s.pos;
+    snap->data = SDL_malloc(snap->size);
+    return snap->data != NULL;
+}
+void sys_snapshot_deinit(sys_snapshot *snap)
+{
+    SDL_free(snap->data);
+    snap->data = NULL;
+}
+void sys_save_snapshot(sys_snapshot *snap)
+{
+    snapshot s = { SNAPSHOT_SAVE, snap->data, 0 };
+    snapshot_all(&s);
+}
+void sys_load_snapshot(const sys_snapshot *snap)
+{
+    snapshot s = { SNAPSHOT_LOAD, snap->data, 0 };
+    snapshot_all(&s);
+}
+void sys_set_frame_output(bool render, bool publish) {
+    ppu_set_output(render, publish);
+}
+void sys_request_frame_skip(bool skip) {
+    ppu_request_frame_skip(skip);
+}
+
+const void *sys_acquire_frame(bool *is_new) {
+    return ppu_acquire_frame(is_new);
+}
+void sys_set_frame_ready_callback(void (*fn)(void)) {
+    ppu_set_frame_ready_callback(fn);
+}
+void sys_set_frame_tap(void (*fn)(const void *frame)) {
+    ppu_set_frame_tap(fn);
+}
+void sys_set_audio_sink(void (*fn)(const int16_t *samples, int frames)) {
+    apu_set_sample_sink(fn);
+}
+bool sys_set_channel_sink(void (*fn)(int channel, const int16_t *samples,
+    int frames))
+{
+    return apu_set_channel_sink(fn);
+}
+void sys_flush_audio(void) {
+    apu_flush();
+}
+apu_stats sys_get_apu_stats(void) {
+    return apu_get_stats();
+}
+const bool *sys_get_dirty_lines() {
+    return ppu_get_dirty_lines();
+}
+int sys_get_frame_pitch() {
+    return ppu_get_frame_pitch();
+}
+const uint32_t *sys_get_palette_colors(int idx) {
+    return ppu_get_palette_colors(idx);
+}
+void sys_select_palette(int idx) {
+    ppu_select_palette(idx);
+}
+ppu_frame_stats sys_get_frame_stats() {
+    return ppu_get_frame_stats();
+}
+byte sys_peek(uint16_t addr) {
+    return bus_peek(addr);
+}
+
+/* FNV-1a over the CPU registers and the whole address space, as seen without
+   PPU or DMA conflicts. */
+uint64_t sys_state_hash()
+{
+    uint64_t h = 0xCBF29CE484222325ull;
+    cpu_state cpu = cpu_get_state();
+    uint16_t cpu_regs[] = {
+        cpu.af_reg, cpu.bc_reg, cpu.de_reg, cpu.hl_reg, cpu.sp_reg, cpu.pc_reg,
+        cpu.ime_flag
+    };
+    for (size_t i = 0; i < sizeof(cpu_regs) / sizeof(cpu_regs[0]); i++) {
+        h = (h ^ get_lo_byte(cpu_regs[i])) * 0x100000001B3ull;
+        h = (h ^ get_hi_byte(cpu_regs[i])) * 0x100000001B3ull;
+    }
+    for (uint32_t addr = 0; addr <= 0xFFFF; addr++)
+        h = (h ^ bus_peek((uint16_t)addr)) * 0x100000001B3ull;
+    return h;
+}
+
+cpu_state sys_get_cpu_state(void) {
+    return cpu_get_state();
+}
+const byte *sys_get_wram(void) {
+    return wram;
+}
+const byte *sys_get_hram(void) {
+    return cpu_get_hram();
 }
 
 byte wram_read(uint16_t addr) {
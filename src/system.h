@@ -1,5 +1,8 @@
 #pragma once
 #include "byte.h"
+#include "ppu.h"
+#include "cpu.h"
+#include "apu.h"
 #include <stdint.h>
 #include <stdbool.h>
 #include <SDL3/SDL.h>
@@ -14,14 +17,69 @@
 
 typedef struct {
     const char *rom_path;
-    SDL_Mutex *frame_mux;
+    ppu_format frame_format;
+    /* Generate pixels on a separate thread. */
+    bool threaded_render;
+    /* Only regenerate lines whose inputs changed since the last frame. */
+    bool incremental_render;
+    /* Audio sample rate in Hz, or 0 for APU_DEFAULT_RATE. */
+    int audio_rate;
+    /* Load and save battery-backed RAM and clocks next to the ROM. */
+    bool persist;
 } system_args;
 
 bool sys_init(system_args args);
 void sys_tick(void);
-void sys_start_frame(void);
+/* start_ns is the host time (SDL_GetTicksNS) the frame begins at, and span_ns
+   the host time it is paced to take (0: unpaced). Key transitions are applied
+   once the frame has reached their host time. A start_ns of 0 runs the frame
+   without taking input, e.g. for run-ahead. */
+void sys_start_frame(Uint64 start_ns, Uint64 span_ns);
+/* Called by the window thread, with the event timestamp. */
+void sys_push_key(SDL_Scancode scancode, bool pressed, Uint64 timestamp_ns);
 void sys_deinit(void);
-uint8_t *sys_get_frame_buffer(void);
+const void *sys_acquire_frame(bool *is_new);
+/* fn is called on the publishing thread (the system thread, or the render
+   thread) after each frame is published. */
+void sys_set_frame_ready_callback(void (*fn)(void));
+/* fn is called on the publishing thread with each completed frame (packed
+   rows) before it is published, or NULL for frames emulated without pixels. */
+void sys_set_frame_tap(void (*fn)(const void *frame));
+/* fn is called on the emulation thread with interleaved stereo samples. */
+void sys_set_audio_sink(void (*fn)(const int16_t *samples, int frames));
+/* Same, with each channel (0-3) as it is mixed. */
+bool sys_set_channel_sink(void (*fn)(int channel, const int16_t *samples,
+    int frames));
+/* Passes the samples completed so far to the sinks. */
+void sys_flush_audio(void);
+apu_stats sys_get_apu_stats(void);
+const bool *sys_get_dirty_lines(void);
+int sys_get_frame_pitch(void);
+const uint32_t *sys_get_palette_colors(int idx);
+void sys_select_palette(int idx);
+ppu_frame_stats sys_get_frame_stats(void);
+/* In-memory copy of the machine state, not including the cartridge ROM. Not
+   available with the render thread. */
+typedef struct {
+    byte *data;
+    size_t size;
+} sys_snapshot;
+bool sys_snapshot_init(sys_snapshot *snap);
+void sys_snapshot_deinit(sys_snapshot *snap);
+void sys_save_snapshot(sys_snapshot *snap);
+void sys_load_snapshot(const sys_snapshot *snap);
+/* For the frames that follow: whether to generate pixels, and whether to
+   publish completed frames to sys_acquire_frame. */
+void sys_set_frame_output(bool render, bool publish);
+/* Whether the next frame to begin is emulated without generating pixels.
+   Ignored with the render thread. */
+void sys_request_frame_skip(bool skip);
+
+byte sys_peek(uint16_t addr);
+uint64_t sys_state_hash(void);
+cpu_state sys_get_cpu_state(void);
+const byte *sys_get_wram(void);
+const byte *sys_get_hram(void);
 
 byte wram_read(uint16_t addr);
 void wram_write(uint16_t addr, byte val);
\ No newline at end of file
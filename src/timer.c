@@ -2,11 +2,16 @@
 #include "system.h"
 #include <stdint.h>
 #include "interrupt.h"
+#include "apu.h"
 
 /* Divider and timer. */
 
 /* Internal T-cycle counter. */
 static uint64_t system_counter;
+/* Counted before the last DIV reset, since power on. */
+static uint64_t counted_before_reset;
+
+#define BOOT_COUNTER 0xEAF3
 
 #define TAC_RW_MASK  0x07
 
@@ -34,11 +39,27 @@ bool timer_init(void)
     tima_reg = 0x00, tma_reg = 0x00, tac_reg = 0xF8;
     update_tac_caches();
 
-    system_counter = 0xEAF3;
+    system_counter = BOOT_COUNTER;
+    counted_before_reset = 0;
 
     return true;
 }
 
+void timer_snapshot(snapshot *s)
+{
+    SNAPSHOT(s, system_counter);
+    SNAPSHOT(s, counted_before_reset);
+    SNAPSHOT(s, div_reg);
+    SNAPSHOT(s, tima_reg);
+    SNAPSHOT(s, tma_reg);
+    SNAPSHOT(s, tac_reg);
+    SNAPSHOT(s, tac_enable);
+    SNAPSHOT(s, tac_counter_bit_idx);
+    SNAPSHOT(s, prev_timer_signal);
+    SNAPSHOT(s, timer_overflowed);
+    SNAPSHOT(s, tma_overflow_save);
+}
+
 static void check_signal(void) {
     bit next_timer_signal =
         get_bit(system_counter, tac_counter_bit_idx) & tac_enable;
@@ -79,10 +100,20 @@ static void update_tac_caches()
     }
 }
 
+uint64_t timer_get_counter() {
+    return system_counter;
+}
+uint64_t timer_get_cycles() {
+    return counted_before_reset + system_counter - BOOT_COUNTER;
+}
+
 byte timer_div_read() {
     return div_reg;
 }
 void timer_div_write(byte val) {
+    /* The frame sequencer is clocked by the falling edge of bit 12. */
+    apu_div_reset(system_counter);
+    counted_before_reset += system_counter;
     system_counter = 0;
     check_signal();
 }
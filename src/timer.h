@@ -1,9 +1,16 @@
 #pragma once
 #include "byte.h"
+#include "snapshot.h"
+#include <stdint.h>
 #include <stdbool.h>
 
 bool timer_init(void);
 void timer_tick(void);
+void timer_snapshot(snapshot *s);
+/* The internal T-cycle counter DIV is the upper byte of. */
+uint64_t timer_get_counter(void);
+/* T-cycles emulated since power on, unlike the counter. */
+uint64_t timer_get_cycles(void);
 
 byte timer_div_read(void);
 void timer_div_write(byte val);